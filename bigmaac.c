@@ -1,11 +1,16 @@
 #define _GNU_SOURCE
 #include "bigmaac.h"
+#include "bigmaac_api.h"
+#include "bigmaac_trace.h"
 
 #include <assert.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <execinfo.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -13,20 +18,46 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/vfs.h>
+#if __has_include(<linux/fs.h>)
+#include <linux/fs.h>  // FICLONE
+#endif
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define BIGMAAC_IO_URING 1
+#endif
+#if __has_include(<linux/userfaultfd.h>)
+#include <linux/userfaultfd.h>
+#define BIGMAAC_TIER 1
+#endif
+#if __has_include(<linux/mempolicy.h>) && defined(SYS_mbind) && defined(SYS_getcpu)
+#include <linux/mempolicy.h>
+#include <sys/sysmacros.h>
+#define BIGMAAC_NUMA 1
+#endif
+#endif
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #if defined(__APPLE__)
 #include <TargetConditionals.h>
 #if TARGET_OS_OSX
 #include <malloc/malloc.h>
-#define MALLOCSIZE malloc_size
+#define MALLOCSIZE "malloc_size"
 #else
 #error "Unsupported Apple platform"
 #endif
 #elif __linux__
 #include <malloc.h>
-#define MALLOCSIZE malloc_usable_size
+#define MALLOCSIZE "malloc_usable_size"
 #else
 #error "Unsupported compiler"
 #endif
@@ -53,79 +84,462 @@
 #define OOM()                                                      \
 	fprintf(stderr, "BigMaac : Failed to find available space\n"); \
 	errno = ENOMEM;
-#define LARGER_GAP(h, a, b) (((h->node_array[a]->size) > (h->node_array[b]->size)) ? a : b)
 #define SIZE_TO_MULTIPLE(size, multiple) ((size % multiple) > 0 ? size + (multiple - size % multiple) : size)
-#define SWAP_NODES(na, idx_a, idx_b)  \
-	{                                 \
-		na[idx_a]->heap_idx = idx_b;  \
-		na[idx_b]->heap_idx = idx_a;  \
-		struct node* tmp = na[idx_a]; \
-		na[idx_a] = na[idx_b];        \
-		na[idx_b] = tmp;              \
-	}
-#define UNLINK(n)                            \
-	{                                        \
-		node* tmp = n;                       \
-		tmp->next->previous = tmp->previous; \
-		tmp->previous->next = tmp->next;     \
-	}
-
-enum memory_use { IN_USE = 0, FREE = 1 };
+#define UNLINK(n)                                \
+	{                                            \
+		node* tmp = n;                           \
+		if (tmp->next != NULL) {                 \
+			tmp->next->previous = tmp->previous; \
+		}                                        \
+		tmp->previous->next = tmp->next;         \
+	}
+
+#define MAX_FRY_ARENAS 64
+#define TCACHE_BIN_SIZE 16
+#define TCACHE_BATCH (TCACHE_BIN_SIZE / 2)
+#define NODE_SLAB_SIZE (1024 * 64)
+#define MAX_FILE_POOL 64
+#define MAX_EXTENT_CACHE 64
+#define MAX_STORE_FILES 64
+#define MAX_TEMPLATES 32
+#define MAX_STRIPE_FILES (MAX_TEMPLATES * (MAX_STORE_FILES + 1))  // the fries and each store file striped over every template
+#define PERSIST_MAGIC "BIGMAAC1"
+#define MAX_NUMA_NODES 64  // bits of a nodemask
+#define MAX_SCOPES 64      // nested bigmaac_scope_begin() per thread
+#define FORCE_FLAGS (BIGMAAC_FORCE_FRY | BIGMAAC_FORCE_BIGMAAC | BIGMAAC_FORCE_RAM | BIGMAAC_FORCE_DISK)
+#define TRACE_RING_SIZE 8192   // events per thread between flushes
+#define TRACE_SKIP_FRAMES 6    // of BigMaac at most above the call site, trace_record and nested entry points
+#define TRACE_FLUSH_US 100000  // how often the rings are written out
+#define MAX_RSS_VICTIMS (1024 * 64)
+#define RSS_SPAN (1024 * 1024 * 64)  // at most this much is paged out in one go
+#define RSS_LOW_WATERMARK 90         // percent of the limit reclaim aims for
+#define MAX_IO_QUEUE 256               // hinted ranges waiting for the I/O engine
+#define MAX_IO_DEPTH 4096
+#define IO_PIECE_SIZE (1024 * 1024)  // ranges are split into requests of this size
+#define TIER_BATCH_PAGES 64           // pages write protected and compressed under one lock
+#define TIER_FAULT_AROUND 16          // compressed pages after a faulting one brought back with it
+#define TIER_MAX_RATIO 2              // pages that do not compress to at most 1/this go to the file tier
+#define ADAPTIVE_MAPS_HIGH 75         // percent of vm.max_map_count in BigMaac mappings that raises the bigmaac cutoff
+#define ADAPTIVE_MAPS_LOW 25          // and below which it goes back
+#define ADAPTIVE_FRAGMENTED 0.5       // fries fragmentation that lowers the bigmaac cutoff
+#define ADAPTIVE_SIZE_CLASSES 64      // powers of two
+
+// KEPT: freed, but the journal of BIGMAAC_PERSIST lists it. CACHED: in a bin of a thread cache
+enum memory_use { IN_USE = 0, FREE = 1, KEPT = 2, CACHED = 3 };
+enum backing { BACKING_TEMPLATE = 0, BACKING_TMPFILE = 1, BACKING_MEMFD = 2 };
+enum hugepages { HUGEPAGES_OFF = 0, HUGEPAGES_THP = 1, HUGEPAGES_HUGETLB = 2 };
+enum io_engine { IO_ENGINE_SYNC = 0, IO_ENGINE_URING = 1 };
+enum placement { PLACEMENT_ROUND_ROBIN = 0, PLACEMENT_MOST_FREE = 1 };
+enum fork_mode { FORK_PRIVATE = 0, FORK_SHARED = 1 };
 enum load_status { LIBRARY_FAIL = -1, NOT_LOADED = 0, LOADING_MEM_FUNCS = 1, LOADING_LIBRARY = 2, LOADED = 3 };
 
 typedef struct heap {
-	size_t used;
-	size_t length;
-	struct node** node_array;
+	size_t used;              // number of free nodes
+	struct node* root;        // free nodes by size, then address
+	struct node* free_nodes;  // slab free list, linked through next
 } heap;
 
 typedef struct node {
 	struct node* next;
 	struct node* previous;
 	enum memory_use in_use;
-	int heap_idx;
+	struct node* left;  // heap links while free
+	struct node* right;
+	int maps;  // number of file mappings backing an in use bigmaac
+	int fd;    // while maps > 0 the file of the bigmaac, mapped at offset ptr - this->ptr, or -1
+	bool shared;     // bigmaac_share(), forked children map it as is
+	bool inherited;  // in a file of the parent process or an import, this one must not punch or resize it
+	bool exported;   // bigmaac_export(), other processes map its file
+	bool journaled;  // listed in the last journal of BIGMAAC_PERSIST, not punched or reused until the next one
 	char* ptr;
 	size_t size;
 	heap* heap;
+	unsigned long long born;  // allocation order, set with BIGMAAC_RSS_LIMIT only
 } node;
 
+typedef struct arena {
+	pthread_mutex_t lock;
+	heap heap;
+	node* head;
+	char* base;
+	char* end;
+	char* fresh;  // nothing at or past this address was ever handed out, so it still reads as zero
+	size_t used;
+	unsigned long long lock_wait_ns;  // time threads spent waiting for the lock, updated under it
+} arena;
+
+typedef struct counters {  // per kind of chunk, updated with __atomic ops
+	unsigned long long allocs;
+	unsigned long long frees;
+	unsigned long long bytes_requested;
+	unsigned long long bytes_allocated;
+	unsigned long long size_classes[ADAPTIVE_SIZE_CLASSES];  // allocations by power of two, only counted for BIGMAAC_ADAPTIVE
+} counters;
+
+typedef struct trace_ring {
+	struct trace_ring* next;  // all rings ever made, they are reused but never freed
+	int owned;                // a thread is writing to this ring
+	uint64_t head;            // advanced by the owning thread only
+	uint64_t tail;            // advanced by the flush only
+	uint64_t dropped;
+	trace_event events[TRACE_RING_SIZE];
+} trace_ring;
+
+typedef struct rss_victim {  // a range of in use chunks the rss limit may page out
+	char* ptr;
+	size_t size;
+	unsigned long long born;  // of the youngest chunk in it
+	char* chunk;              // start of the chunk it is part of, NULL when it covers several
+	bool dontneed;            // MADV_DONTNEED only drops clean pages, not so where it may be mapped MAP_PRIVATE
+} rss_victim;
+
+typedef struct tier_page {  // a page of a bigmaac held compressed in RAM
+	uint32_t length;
+	char data[];
+} tier_page;
+
+typedef struct swap_template {  // one entry of BIGMAAC_TEMPLATE
+	char* path;
+	char* dir;        // directory part of the template for O_TMPFILE
+	bool no_tmpfile;  // its file system does not know O_TMPFILE
+	bool no_clone;    // its file system cannot clone files for forked children
+	dev_t dev;        // of dir, to find the template of a file
+	int numa_node;    // of the device it is on, -1 when not known
+} swap_template;
+
+typedef struct stripe {  // a mapping of the fries or the store, made at start up
+	char* ptr;
+	size_t size;
+	int fd;  // kept open for forked children, -1 once this process does not own the file
+	off_t offset;
+} stripe;
+
+typedef struct persist_header {  // the journal of BIGMAAC_PERSIST, followed by its chunks
+	char magic[8];
+	uint64_t base;  // of the reserved range, the fries come first
+	uint64_t size_fries;
+	uint64_t size_bigmaac;
+	uint64_t bigmaac_multiple;
+	uint64_t page_size;
+	int32_t n_fry_arenas;
+	int32_t n_store_files;
+	uint64_t root;  // bigmaac_set_root()
+	uint64_t n_chunks;
+} persist_header;
+
+typedef struct persist_chunk {  // an in use chunk, in address order
+	uint64_t ptr;
+	uint64_t size;
+} persist_chunk;
+
+typedef struct io_request {  // a hinted range queued for the I/O engine
+	char* ptr;
+	size_t len;
+	int advice;
+	int fd;  // for WRITEBACK a duplicate of the file under ptr, which is at offset in it, or -1
+	off_t offset;
+} io_request;
+
+#if defined(BIGMAAC_IO_URING)
+typedef struct io_ring {  // the parts of an io_uring we use, set up without liburing
+	int fd;
+	unsigned entries;
+	unsigned in_flight;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+} io_ring;
+#endif
+
+typedef struct tcache_bin {
+	int count;
+	node* nodes[TCACHE_BIN_SIZE];
+} tcache_bin;
+
 // heap operations
-static void heap_remove_idx(heap* const heap, const int idx);
-static void heapify_up(heap* const heap, const int idx);
-static void heapify_down(heap* const heap, const int idx);
+FORCE_INLINE bool node_before(const node* const a, const node* const b);
+FORCE_INLINE uint64_t node_priority(const node* const n);
+static node* tree_insert(node* const root, node* const n);
+static node* tree_merge(node* const a, node* const b);
+static node* tree_remove(node* const root, node* const n);
 static int heap_insert(node* const head, node* const n);
+static void heap_remove(heap* const heap, node* const n);
+static node* heap_best_fit(heap* const heap, const size_t size);
+static node* heap_largest(heap* const heap);
 static int heap_free_node(node* const head, node* const n);
 static node* heap_pop_split(node* const head, const size_t size);
+static node* heap_pop_aligned(node* const head, const size_t size, const size_t alignment);
+static int heap_grow_node(node* const head, node* const n, const size_t size);
+static node* heap_split_node(node* const head, node* const n, const size_t size);
 static node* heap_find_node(void* const ptr);
-static void heapify_down(heap* const heap, const int idx);
 
 // linked list operations
-static node* ll_new(void* const ptr, const size_t size);
+static node* ll_new(heap* const heap, void* const ptr, const size_t size);
+
+// metadata operations
+static void* meta_map(const size_t size);
+static void meta_unmap(void* const ptr, const size_t size);
+static node* node_new(heap* const heap);
+static void node_delete(heap* const heap, node* const n);
+
+// address index operations
+static int index_init(void);
+FORCE_INLINE node** index_slot(void* const ptr);
+static node* index_find_chunk(arena* const a, char* const ptr);
+
+// arena operations
+static int arena_init(arena* const a, void* const base, const size_t size);
+static node* arena_pop(arena* const a, const size_t size, const size_t alignment, size_t* const dirty);
+static int arena_pop_batch(arena* const a, const size_t size, node** const nodes, const int count);
+static int arena_free_node(arena* const a, node* const n);
+FORCE_INLINE void arena_lock(arena* const a);
+FORCE_INLINE arena* arena_of(void* const ptr);
+FORCE_INLINE int fry_arena_for_thread(void);
+
+// thread cache operations
+static tcache_bin* tcache_for_thread(void);
+static void tcache_drain(tcache_bin* const bin, const int count);
+static void tcache_destroy(void* const tc);
+static void* tcache_get(const size_t size);
+static bool tcache_put(void* const ptr);
 
 static void bigmaac_init(void);
+#if !defined(NOTCOMPAT)
+static void bigmaac_constructor(void);
+#endif
+static void init_done(const enum load_status state);
+static bool init_wait(void);
+static void pass_through_update(void);
+
+// backing file operations
+static int template_pick(void);
+static int tmpfile_open_at(swap_template* const t);
+static int tmpfile_open(void);
+static void* file_pool_worker(void* const arg);
+static int file_pool_get(void);
+
+// freed bigmaac extent operations
+static bool extent_put(void* const ptr);
+static void* extent_get(const size_t size);
+
+// access hint operations
+static int advice_parse(const char* const s);
+static int advise_range(void* const ptr, const size_t len, const int advice);
+static int file_advice(const int advice);
+
+// I/O engine operations
+static bool io_queue_put(const io_request r);
+static void* io_worker(void* const arg);
+#if defined(BIGMAAC_IO_URING)
+static bool io_ring_setup(io_ring* const ring, const unsigned entries);
+static void io_ring_submit(io_ring* const ring, const unsigned min_complete);
+static void io_ring_queue(io_ring* const ring, const io_request r);
+#endif
+
+// statistics operations
+FORCE_INLINE void* count_alloc(counters* const c, const size_t requested, const size_t size, void* const ptr);
+FORCE_INLINE void count_free(void* const ptr);
+static void arena_stats(arena* const a, struct bigmaac_arena_stats* const s);
+static void* stats_worker(void* const arg);
+static bool thread_start(void* (*const worker)(void*));
+static size_t resident_bytes(char* const start, char* const end);
+
+// rss limit operations
+FORCE_INLINE void rss_born(node* const n);
+static void rss_find_cgroup(void);
+static size_t rss_usage(void);
+static size_t rss_collect(arena* const a, rss_victim* const victims, size_t count);
+static size_t rss_page_out(const rss_victim* const v);
+static void* rss_worker(void* const arg);
+
+// adaptive threshold operations
+static size_t adaptive_halve(const size_t size, const size_t low);
+static size_t adaptive_double(const size_t size, const size_t high);
+static void* adaptive_worker(void* const arg);
+
+// compressed tier operations
+static bool tier_start(void);
+static void tier_begin(char* const ptr, const size_t size, const bool restore);
+static void tier_end(void);
+static size_t tier_evict(const rss_victim* const v);
+static void* tier_worker(void* const arg);
+static void tier_restore(void);
+#if defined(BIGMAAC_TIER)
+static bool tier_chunk_in_use(char* const chunk, char* const end);
+static int tier_protect(char* const ptr, const size_t len, const bool protect);
+static bool tier_fill(char* const page);
+#endif
+
+// tracing operations
+FORCE_INLINE uint64_t trace_now(void);
+FORCE_INLINE uint64_t trace_start(void);
+static void trace_record(const int op, const uint64_t start, void* const ptr, const size_t size, void* const site);
+static trace_ring* trace_ring_for_thread(void);
+static void trace_release(void* const ring);
+static void trace_write(const uint32_t kind, const void* const data, const size_t length);
+static void trace_write_maps(void);
+static void trace_flush(void);
+static void* trace_worker(void* const arg);
+static void trace_finish(void);
+
+// NUMA operations
+static void numa_init(void);
+static int numa_node_of_dir(const char* const dir);
+static void numa_bind(void* const ptr, const size_t size, const int node);
+
+// huge page operations
+static size_t hugepage_size(void);
+static void hugepage_report(void);
+
+// fork operations
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_unlock(void);
+static void fork_pin(void);
+static void fork_child(void);
+static void fork_restart(void);
+static int file_clone(const int fd);
+static int file_copy(const int fd);
+static bool range_copy(const int from, const int to, off_t offset, size_t length);
+static int memory_copy(char* const ptr, const size_t size);
+static bool memory_copy_anonymous(char* const ptr, const size_t size);
+static size_t stripe_find(char* const ptr);
+static int chunk_file(const node* const n, off_t* const offset);
+static int stripes_map(char* const ptr, const size_t size, const int flags);
+
+// persistence operations
+static bool persist_load(void);
+static int persist_open(void);
+static int persist_restore(void);
+static int persist_write(const bool sync);
+static void persist_finish(void);
+static bool persist_keep(void* const ptr);
 
 // BigMaac helper functions
 static int mmap_tmpfile(void* const ptr, const size_t size);
+static int mmap_extend(const int fd, char* const base, char* const ptr, const size_t size);
+static int fd_keep(const int fd);
+static void fd_drop(const int fd);
+static int mmap_striped(char* const ptr, const size_t size);
+static bool stripe_add(char* const ptr, const size_t size, const int fd, const off_t offset);
+static void mmap_advise(void* const ptr, const size_t size);
+static int store_init(void);
+static int unmap_chunk(node* const n, char* const ptr, const size_t size);
 static int remove_chunk_with_ptr(void* const ptr, void* const prev_ptr, const size_t prev_size);
-static void* create_chunk(const size_t size);
+static int free_chunk(void* const ptr);
+static void* create_chunk(const bool bigmaac, size_t size, const bool zero, const size_t alignment);
+static int grow_chunk(void* const ptr, size_t size);
+static int shrink_chunk(void* const ptr, size_t size);
+static void* malloc_chunk(const size_t size, void* const site);
+static void* calloc_chunk(const size_t count, const size_t size, void* const site);
+static void* realloc_chunk(void* ptr, size_t size, void* const site);
+static int memalign_chunk(void** const memptr, const size_t alignment, const size_t size, void* const site);
+static void* aligned_chunk(const size_t alignment, const size_t size, void* const site);
+#if defined(__linux__)
+static void* move_chunk(void* const ptr, size_t size);
+#endif
 
-static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static void* (*real_malloc)(size_t) = NULL;
 static void* (*real_calloc)(size_t, size_t) = NULL;
 static void* (*real_free)(size_t) = NULL;
 static void* (*real_realloc)(void*, size_t) = NULL;
+static int (*real_posix_memalign)(void**, size_t, size_t) = NULL;
+static void* (*real_aligned_alloc)(size_t, size_t) = NULL;
+static void* (*real_memalign)(size_t, size_t) = NULL;  // not everywhere, NULL then
+static size_t (*real_malloc_usable_size)(void*) = NULL;
 // static void* (*real_reallocarray)(void*, size_t, size_t) = NULL;
 
 // GLOBAL vars
 static int active_mmaps = 0;
 
-static node* _head_bigmaacs;  // head of the bigmaac heap
-static node* _head_fries;     // head of the fries heap
-
-static size_t min_size_bigmaac = DEFAULT_MIN_BIGMAAC_SIZE;
+static arena arena_bigmaacs;                 // the bigmaac heap
+static arena arena_fries[MAX_FRY_ARENAS];  // the fries heap, split into independently locked sub-arenas
+static int n_fry_arenas = DEFAULT_FRY_ARENAS;
+static size_t size_fry_arena = 0;
+static int next_fry_arena = 0;
+static __thread int thread_fry_arena = -1;
+
+static bool numa = DEFAULT_NUMA;
+static int n_numa_nodes = 1;                    // highest online node + 1, always 1 without BIGMAAC_NUMA
+static unsigned long long numa_template_nodes = 0;  // nodes with a template on a device of their own
+static __thread int thread_numa_node = -1;
+
+static size_t tcache_max_size = DEFAULT_TCACHE_MAX_SIZE;
+static size_t n_tcache_bins = 0;
+static pthread_key_t tcache_key;
+static __thread tcache_bin* thread_tcache = NULL;  // one bin per fry_size_multiple up to tcache_max_size
+
+static int file_pool[MAX_FILE_POOL];  // unlinked backing files ready to be sized and mapped
+static int file_pool_count = 0;
+static int file_pool_size = DEFAULT_FILE_POOL;
+static bool file_pool_started = false;
+static pthread_mutex_t file_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t file_pool_cond = PTHREAD_COND_INITIALIZER;
+
+static node* extent_cache[MAX_EXTENT_CACHE];  // freed bigmaacs kept mapped, oldest first, guarded by the bigmaac lock
+static int extent_cache_count = 0;
+static int extent_cache_size = DEFAULT_EXTENT_CACHE;
+
+static counters counters_fries;
+static counters counters_bigmaacs;
+static unsigned long long realloc_bytes_copied = 0;
+static int stats_interval = DEFAULT_STATS_INTERVAL;  // seconds between dumps, 0 for none
+static char* stats_file = NULL;                      // stderr when not set
+
+static size_t rss_limit = DEFAULT_RSS_LIMIT;              // bytes, 0 for no limit
+static int rss_interval_ms = DEFAULT_RSS_INTERVAL_MS;
+static char rss_usage_file[4096] = "";                    // memory.current of our cgroup, /proc/self/statm if empty
+static unsigned long long rss_clock = 0;
+
+static size_t tier_limit = DEFAULT_COMPRESSED_TIER;  // compressed bytes the tier may hold, 0 for no tier
+static int tier_fd = -1;                             // the userfaultfd bringing pages back in
+static tier_page** tier_pages = NULL;                // one slot per page of the bigmaac arena
+static tier_page tier_zero = {.length = 0};          // shared by all zero pages
+static size_t tier_bytes = 0;                        // of bigmaac data in the tier
+static size_t tier_stored = 0;                       // what that takes after compression
+static char* tier_buffer = NULL;                     // page_size * 2 of scratch space, guarded by tier_lock
+static pthread_mutex_t tier_lock = PTHREAD_MUTEX_INITIALIZER;
+static int (*lz4_compress)(const char*, char*, int, int) = NULL;    // LZ4_compress_default() when liblz4 is around
+static int (*lz4_decompress)(const char*, char*, int, int) = NULL;  // LZ4_decompress_safe()
+
+static int trace_fd = -1;  // BIGMAAC_TRACE output, tracing is off without it
+static char* trace_prefix = NULL;  // BIGMAAC_TRACE, forked children trace to a file of their own
+static int trace_backtrace = DEFAULT_TRACE_BACKTRACE;  // sample a backtrace every this many events, 0 for none
+static trace_ring* trace_rings = NULL;
+static pthread_key_t trace_key;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;  // serializes flushes
+static pthread_cond_t trace_cond = PTHREAD_COND_INITIALIZER;    // wakes the flush early when a ring fills up
+static __thread trace_ring* thread_trace_ring = NULL;
+static __thread unsigned thread_trace_count = 0;
+static __thread bool thread_tracing = false;  // set while recording, so a backtrace allocating is not traced
+
+static int scopes_active = 0;  // threads inside a bigmaac_scope_begin(), the others skip looking at theirs
+static __thread int thread_scopes[MAX_SCOPES];
+static __thread int thread_scope_depth = 0;
+
+static int n_store_files = DEFAULT_STORE_FILES;  // files the bigmaac arena is consolidated into, 0 for a file per bigmaac
+
+static stripe* stripes = NULL;  // the mappings of the fries and the store files in address order
+static size_t n_stripes = 0;
+static size_t stripes_capacity = 0;
+static enum fork_mode fork_mode = FORK_PRIVATE;
+static bool fries_inherited = false;  // a forked child reading the fries of its parent, it allocates none
+
+static size_t min_size_bigmaac = DEFAULT_MIN_BIGMAAC_SIZE;  // moved at run time with BIGMAAC_ADAPTIVE, read with __atomic_load_n
 static size_t min_size_fry = DEFAULT_MIN_FRY_SIZE;
 
+static bool adaptive = DEFAULT_ADAPTIVE;
+static int adaptive_interval_ms = DEFAULT_ADAPTIVE_INTERVAL_MS;
+static size_t adaptive_low = DEFAULT_ADAPTIVE_LOW;    // the cutoffs stay within [adaptive_low, adaptive_high]
+static size_t adaptive_high = DEFAULT_ADAPTIVE_HIGH;
+
 static void* base_fries = 0x0;
 static void* base_bigmaac = 0x0;
 static void* end_fries = 0x0;
@@ -133,17 +547,49 @@ static void* end_bigmaac = 0x0;
 
 static size_t size_fries = DEFAULT_MAX_FRIES;
 static size_t size_bigmaac = DEFAULT_MAX_BIGMAAC;
-static char* template = DEFAULT_TEMPLATE;
+static swap_template templates[MAX_TEMPLATES];
+static int n_templates = 0;
+static int next_template = 0;
+static enum placement placement = PLACEMENT_ROUND_ROBIN;  // of bigmaac files over the templates
+static size_t stripe_size = DEFAULT_STRIPE_SIZE;        // of the fries and the store over the templates, 0 for one piece each
+static enum backing backing = BACKING_TMPFILE;
+static int advice_fries = BIGMAAC_NORMAL;     // applied to every new mapping of the arena
+static int advice_bigmaacs = BIGMAAC_NORMAL;
+static enum io_engine io_engine = IO_ENGINE_SYNC;
+static int io_depth = DEFAULT_IO_DEPTH;                  // io_uring requests in flight
+static io_request io_queue[MAX_IO_QUEUE];
+static int io_queue_head = 0;
+static int io_queue_count = 0;
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_cond = PTHREAD_COND_INITIALIZER;
 static size_t fry_size_multiple = DEFAULT_FRY_SIZE_MULTIPLE;
 
-static size_t used_fries = 0;
-static size_t used_bigmaacs = 0;
 static size_t page_size = 0;
+static size_t bigmaac_multiple = 0;  // bigmaacs and the arenas are aligned to this, the page or huge page size
+static enum hugepages hugepages = HUGEPAGES_OFF;
+static int map_shared = MAP_SHARED;  // how backing files are mapped, without a reservation of huge pages with hugetlb
+
+static node** index_fries = NULL;     // one slot per fry_size_multiple of the fries arena
+static node** index_bigmaacs = NULL;  // one slot per page of the bigmaac arena
+
+static enum load_status load_state = NOT_LOADED;  // stored with release once loaded or failed
+static size_t pass_through_below = 0;  // sizes below go straight to the system allocator, 0 until BigMaac is loaded
+static pthread_mutex_t pass_through_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread bool thread_initializing = false;  // this thread holds init_lock, its allocations go to the system
+
+static int fork_pipe[2] = {-1, -1};  // the child tells its parent it has copies of all files, BIGMAAC_FORK=private
+static int kept_fds = 0;      // files of bigmaacs kept open
+static int max_kept_fds = 0;  // a quarter of RLIMIT_NOFILE, the rest is left to the application
 
-static enum load_status load_state = NOT_LOADED;
+static char* persist_dir = NULL;                 // BIGMAAC_PERSIST, the arena is kept there across restarts
+static int persist_files = 0;                    // named files opened so far, in the order the arena is mapped
+static persist_header* persist_journal = NULL;   // of the process before, until it is restored
+static size_t persist_journal_size = 0;
+static void* persist_root = NULL;
+static pthread_mutex_t persist_lock = PTHREAD_MUTEX_INITIALIZER;  // one journal written at a time
 
 // debug functions
-static inline void verify_memory(node* head, int global);
+static inline void verify_memory(arena* a, int global);
 static inline void log_bm(const char* data, ...);
 #ifdef DEBUG
 static void print_ll(node* head);
@@ -172,14 +618,24 @@ void log_bm(const char* data, ...) {
 	pthread_mutex_unlock(&log_lock);
 }
 
-static inline void verify_memory(node* head, int global) {
+static inline void verify_memory(arena* a, int global) {
+	node* const head = a->head;
 	// print_heap(head->heap);
 	// print_ll(head);
 	size_t heap_free = 0;
-	for (int i = 0; i < head->heap->used; i++) {
-		assert(head->heap->node_array[i]->ptr != NULL);
-		heap_free += head->heap->node_array[i]->size;
+	size_t heap_nodes = 0;
+	for (node* c = head->next; c != NULL; c = c->next) {  // every free node has to be found in the heap
+		if (c->in_use == FREE) {
+			node* t = head->heap->root;
+			while (t != NULL && t != c) {
+				t = node_before(c, t) ? t->left : t->right;
+			}
+			assert(t == c);
+			heap_free += c->size;
+			heap_nodes++;
+		}
 	}
+	assert(heap_nodes == head->heap->used);
 	size_t t = 0;
 	size_t ll_free = 0;
 	node* prev = NULL;
@@ -194,14 +650,10 @@ static inline void verify_memory(node* head, int global) {
 		c = c->next;
 	}
 	if (global == 1) {
-		if (head == _head_fries) {
-			assert(used_fries == t - ll_free);
-		} else {
-			assert(used_bigmaacs == t - ll_free);
-		}
+		assert(a->used == t - ll_free);
 	}
 	assert(heap_free == ll_free);
-	assert(t == size_bigmaac);
+	assert(t == a->end - a->base);
 }
 
 static __attribute__((__unused__)) void print_ll(node* head) {
@@ -211,485 +663,3610 @@ static __attribute__((__unused__)) void print_ll(node* head) {
 	}
 }
 
-static __attribute__((__unused__)) void print_heap(heap* heap) {
-	for (int i = 0; i < heap->used; i++) {
-		fprintf(stderr, "parent %d node %d , ptr=%p size=%ld\n", (i - 1) / 2, i, heap->node_array[i]->ptr, heap->node_array[i]->size);
+static __attribute__((__unused__)) void print_tree(node* n, int depth) {
+	if (n != NULL) {
+		print_tree(n->left, depth + 1);
+		fprintf(stderr, "depth %d , ptr=%p size=%ld\n", depth, n->ptr, n->size);
+		print_tree(n->right, depth + 1);
 	}
 }
 
+static __attribute__((__unused__)) void print_heap(heap* heap) { print_tree(heap->root, 0); }
+
 #else
 
-static inline void verify_memory(node* head, int global) {}
+static inline void verify_memory(arena* a, int global) {}
 static inline void log_bm(const char* data, ...) {}
 
 #endif
 
 // BigMaac heap
+// Free nodes are kept in a treap ordered by size and then address. Popping takes the smallest free node
+// that fits, with the lowest address among equal sizes (best fit), and the largest free node is the
+// rightmost one. A node's priority is a hash of its address, so the tree shape needs no extra state;
+// a node is always taken out of the tree before its ptr or size change.
 
-static void heap_remove_idx(heap* const heap, const int idx) {
-	if (heap->used == 1) {
-		heap->used = 0;
-		heap->node_array[0]->heap_idx = -1;
-		return;
-	}
+FORCE_INLINE bool node_before(const node* const a, const node* const b) { return a->size < b->size || (a->size == b->size && a->ptr < b->ptr); }
 
-	// take the last one and place it here
-	heap->node_array[idx]->heap_idx = -1;              // node is out of the heap
-	heap->node_array[heap->used - 1]->heap_idx = idx;  // node has moved up in the heap
-	heap->node_array[idx] = heap->node_array[heap->used - 1];
-	heap->used--;  // the heap is now smaller
+FORCE_INLINE uint64_t node_priority(const node* const n) { return (uint64_t)(uintptr_t)n->ptr * 0x9E3779B97F4A7C15ull; }
 
-	heapify_down(heap, idx);
+static node* tree_insert(node* const root, node* const n) {
+	if (root == NULL) {
+		n->left = NULL;
+		n->right = NULL;
+		return n;
+	}
+	if (node_before(n, root)) {
+		root->left = tree_insert(root->left, n);
+		if (node_priority(root->left) > node_priority(root)) {  // rotate right
+			node* const l = root->left;
+			root->left = l->right;
+			l->right = root;
+			return l;
+		}
+	} else {
+		root->right = tree_insert(root->right, n);
+		if (node_priority(root->right) > node_priority(root)) {  // rotate left
+			node* const r = root->right;
+			root->right = r->left;
+			r->left = root;
+			return r;
+		}
+	}
+	return root;
 }
 
-static void heapify_up(heap* const heap, const int idx) {
-	if (idx == 0) {  // this node has no parent
-		return;
+// join two trees where everything in a comes before everything in b
+static node* tree_merge(node* const a, node* const b) {
+	if (a == NULL) {
+		return b;
 	}
-
-	const int parent_idx = (idx - 1) / 2;
-
-	if (LARGER_GAP(heap, idx, parent_idx) != parent_idx) {
-		SWAP_NODES(heap->node_array, idx, parent_idx);
-		heapify_up(heap, parent_idx);
+	if (b == NULL) {
+		return a;
 	}
+	if (node_priority(a) > node_priority(b)) {
+		a->right = tree_merge(a->right, b);
+		return a;
+	}
+	b->left = tree_merge(a, b->left);
+	return b;
 }
 
-static void heapify_down(heap* const heap, const int idx) {
-	int largest_idx = idx;
-
-	const int left_child_idx = (idx + 1) * 2 - 1;
-	const int right_child_idx = (idx + 1) * 2;
-
-	if (left_child_idx < heap->used) {
-		largest_idx = LARGER_GAP(heap, largest_idx, left_child_idx);
+static node* tree_remove(node* const root, node* const n) {
+	if (root == n) {
+		return tree_merge(n->left, n->right);
 	}
-	if (right_child_idx < heap->used) {
-		largest_idx = LARGER_GAP(heap, largest_idx, right_child_idx);
+	if (node_before(n, root)) {
+		root->left = tree_remove(root->left, n);
+	} else {
+		root->right = tree_remove(root->right, n);
 	}
-	if (largest_idx != idx) {
-		SWAP_NODES(heap->node_array, idx, largest_idx);
-		heapify_down(heap, largest_idx);
-	}  // else we are done
+	return root;
 }
 
 static int heap_insert(node* const head, node* const n) {
-	heap* heap = head->heap;
-	if (heap->used == heap->length) {
-		heap->node_array = (node**)real_realloc(heap->node_array, sizeof(node*) * heap->length * 2);
-		if (heap->node_array == NULL) {
-			fprintf(stderr, "BigMaac : failed to heap insert\n");
-			return -1;
+	heap* const heap = head->heap;
+	heap->root = tree_insert(heap->root, n);
+	heap->used++;
+	return 0;
+}
+
+static void heap_remove(heap* const heap, node* const n) {
+	heap->root = tree_remove(heap->root, n);
+	heap->used--;
+}
+
+// smallest free node of at least size bytes
+static node* heap_best_fit(heap* const heap, const size_t size) {
+	node* best = NULL;
+	for (node* c = heap->root; c != NULL;) {
+		if (c->size >= size) {
+			best = c;
+			c = c->left;
+		} else {
+			c = c->right;
 		}
-		head->heap->length *= 2;
 	}
-	// gauranteed to have space
-	heap->node_array[heap->used] = n;
-	n->heap_idx = heap->used;
-
-	heap->used++;
+	return best;
+}
 
-	heapify_up(heap, n->heap_idx);
-	return 0;
+static node* heap_largest(heap* const heap) {
+	node* c = heap->root;
+	while (c != NULL && c->right != NULL) {
+		c = c->right;
+	}
+	return c;
 }
 
 static int heap_free_node(node* const head, node* const n) {
 #ifdef DEBUG
 	assert(n->in_use == IN_USE);
 #endif
-	if (n->next != NULL && n->next->in_use == FREE) {
-		if (n->previous != NULL && n->previous->in_use == FREE) {
-			// update size and pointer
-			n->size += n->previous->size;
-			n->ptr = n->previous->ptr;
-
-			// unlink the node tmp
-			node* tmp = n->previous;
-			UNLINK(n->previous);
-
-			heap_remove_idx(head->heap, tmp->heap_idx);
-			real_free((size_t)tmp);
-		}
-		// update size and pointer
-		n->next->size += n->size;
-		n->next->ptr = n->ptr;
-
+	heap* const heap = head->heap;
+	if (n->previous != NULL && n->previous->in_use == FREE) {  // fold into the free node in front
+		node* const prev = n->previous;
+		heap_remove(heap, prev);
+		prev->size += n->size;
 		UNLINK(n);
-		heapify_up(head->heap, n->next->heap_idx);
-		real_free((size_t)n);
-	} else if (n->previous != NULL && n->previous->in_use == FREE) {
-		// add it to the previous node
-		n->previous->size += n->size;
-
+		node_delete(heap, n);
+		if (prev->next != NULL && prev->next->in_use == FREE) {  // and the one behind
+			node* const next = prev->next;
+			heap_remove(heap, next);
+			prev->size += next->size;
+			UNLINK(next);
+			node_delete(heap, next);
+		}
+		return heap_insert(head, prev);
+	}
+	if (n->next != NULL && n->next->in_use == FREE) {  // fold into the free node behind
+		node* const next = n->next;
+		heap_remove(heap, next);
+		next->size += n->size;
+		next->ptr = n->ptr;
 		UNLINK(n);
-		heapify_up(head->heap, n->previous->heap_idx);
-		real_free((size_t)n);
-	} else {  // add a whole new node
-		n->in_use = FREE;
-		return heap_insert(head, n);
+		node_delete(heap, n);
+		return heap_insert(head, next);
 	}
-	return 0;
+	n->in_use = FREE;  // add a whole new node
+	return heap_insert(head, n);
 }
 
 static node* heap_pop_split(node* const head, const size_t size) {
-	verify_memory(head, 0);
-	if (head->heap->used == 0) {
-		return NULL;
-	}
-
-	heap* heap = head->heap;
-	node** node_array = heap->node_array;
-
-	node* free_node = node_array[0];
-	if (free_node->size < size) {
+	heap* const heap = head->heap;
+	node* const free_node = heap_best_fit(heap, size);
+	if (free_node == NULL) {
 		return NULL;
 	}
 
-	// check left and right child ( avoid further fragmenting largest chunk )
-	// How can you have any pudding if you dont eat yer meat?
-	const int left_child_idx = 1;
-	if (heap->used > left_child_idx && node_array[left_child_idx]->size >= size) {
-		free_node = node_array[left_child_idx];
-	}
-	const int right_child_idx = 2;
-	if (heap->used > right_child_idx && node_array[right_child_idx]->size >= size && node_array[right_child_idx]->size < free_node->size) {
-		free_node = node_array[right_child_idx];
-	}
-
 	if (free_node->size == size) {
-		heap_remove_idx(heap, free_node->heap_idx);
+		heap_remove(heap, free_node);
 		free_node->in_use = IN_USE;
-		verify_memory(head, 1);
+		free_node->journaled = false;
 		return free_node;
 	}
 
 	// need to split this node
-	node* used_node = (node*)real_malloc(sizeof(node));
+	node* used_node = node_new(heap);
 	if (used_node == NULL) {
 		return NULL;
 	}
-	// heapify from this node down
-	*used_node = (node){.size = size, .ptr = free_node->ptr, .next = free_node, .previous = free_node->previous, .in_use = IN_USE, .heap_idx = -1};
+	*used_node = (node){.size = size, .ptr = free_node->ptr, .next = free_node, .previous = free_node->previous, .in_use = IN_USE};
 
-	free_node->size -= size;  // need to now heapify this node
+	heap_remove(heap, free_node);
+	free_node->size -= size;
 	free_node->ptr = free_node->ptr + size;
+	heap_insert(head, free_node);
 
 	free_node->previous->next = used_node;
 	free_node->previous = used_node;
 
-	heapify_down(heap, free_node->heap_idx);
-	verify_memory(head, 1);
-
 	return used_node;
 }
 
-static node* heap_find_node(void* const ptr) {
-	node* head = ptr < base_bigmaac ? _head_fries : _head_bigmaacs;
-	verify_memory(head, 0);
-	while (head != NULL) {
-		if (head->ptr == ptr) {
-			return head;
+// pop an in use node starting on a multiple of alignment, the space cut off in front and behind is freed again
+static node* heap_pop_aligned(node* const head, const size_t size, const size_t alignment) {
+	node* n = heap_pop_split(head, size + alignment);
+	if (n == NULL) {
+		return NULL;
+	}
+
+	const size_t lead = (alignment - (uintptr_t)n->ptr % alignment) % alignment;
+	if (lead > 0) {
+		node* const body = heap_split_node(head, n, lead);
+		if (body == NULL) {
+			heap_free_node(head, n);
+			return NULL;
 		}
-		head = head->next;
+		heap_free_node(head, n);
+		n = body;
 	}
-	return NULL;
+	if (n->size > size) {
+		node* const tail = heap_split_node(head, n, size);
+		if (tail != NULL) {  // otherwise the node just stays a bit larger
+			heap_free_node(head, tail);
+		}
+	}
+	return n;
 }
 
-// BigMaac linked list
-
-static node* ll_new(void* const ptr, const size_t size) {
-	node* const head = (node*)real_malloc(sizeof(node) * 2);
-	if (head == NULL) {
-		fprintf(stderr, "BigMalloc heap: failed to make list\n");
-		return NULL;
+// grow an in use node into the free node right behind it
+static int heap_grow_node(node* const head, node* const n, const size_t size) {
+	node* const next = n->next;
+	const size_t extra = size - n->size;
+	if (next == NULL || next->in_use != FREE || next->size < extra) {
+		return -1;
 	}
 
-	head[0] = (node){.size = 0, .ptr = NULL, .next = head + 1, .previous = NULL, .in_use = IN_USE, .heap_idx = -1};
-	head[1] = (node){.size = size, .ptr = ptr, .next = NULL, .previous = head, .in_use = FREE, .heap_idx = 0};
+	heap_remove(head->heap, next);
+	if (next->size == extra) {  // swallow the free node whole
+		UNLINK(next);
+		node_delete(head->heap, next);
+	} else {
+		next->ptr += extra;
+		next->size -= extra;
+		heap_insert(head, next);
+	}
+	n->size = size;
+	return 0;
+}
 
-	head->heap = (heap*)real_malloc(sizeof(heap));
-	if (head->heap == NULL) {
-		fprintf(stderr, "BigMalloc heap failed\n");
+// cut an in use node down to size, the returned tail node is in use too and can be freed on its own
+static node* heap_split_node(node* const head, node* const n, const size_t size) {
+	node* const tail = node_new(head->heap);
+	if (tail == NULL) {
 		return NULL;
 	}
-	head->heap->node_array = (node**)real_malloc(sizeof(node*) * 1);
-	if (head->heap->node_array == NULL) {
-		fprintf(stderr, "BigMalloc heap failed 2\n");
-		return NULL;
+	*tail = (node){.size = n->size - size, .ptr = n->ptr + size, .next = n->next, .previous = n, .in_use = IN_USE};
+	if (n->next != NULL) {
+		n->next->previous = tail;
 	}
-	head->heap->length = 1;
-	head->heap->used = 1;
-	head->heap->node_array[0] = head + 1;
-
-	return head;
+	n->next = tail;
+	n->size = size;
+	return tail;
 }
 
-// BigMaac
-
-static void bigmaac_init(void) {
-	pthread_mutex_lock(&lock);
-	if (load_state == LIBRARY_FAIL) {
-		return;  // error initializing
-	}
-	if (load_state != NOT_LOADED) {
-		pthread_mutex_unlock(&lock);
-		fprintf(stderr, "Already init %d\n", load_state);
-		return;
-	}
-	fprintf(stderr, "Loading Bigmaac Heap X! PID:%d PPID:%d\n", getpid(), getppid());
-	load_state = LOADING_MEM_FUNCS;
-	real_malloc = dlsym(RTLD_NEXT, "malloc");
-	real_free = dlsym(RTLD_NEXT, "free");
-	real_calloc = dlsym(RTLD_NEXT, "calloc");
-	real_realloc = dlsym(RTLD_NEXT, "realloc");
-	// real_reallocarray = dlsym(RTLD_NEXT, "reallocarray");
-	if (!real_malloc || !real_free || !real_calloc || !real_realloc /* || !real_reallocarray*/) {
-		fprintf(stderr, "Error in `dlsym`: %s\n", dlerror());
+static node* heap_find_node(void* const ptr) {
+	node* const n = *index_slot(ptr);
+	if (n != NULL && n->ptr == ptr) {  // ptr may point into the middle of a slot
+		return n;
 	}
-	load_state = LOADING_LIBRARY;
+	return NULL;
+}
 
-	log_bm("OPEN LIB\n");
+// BigMaac linked list
 
-	page_size = sysconf(_SC_PAGE_SIZE);
+static node* ll_new(heap* const heap, void* const ptr, const size_t size) {
+	*heap = (struct heap){.used = 0, .root = NULL, .free_nodes = NULL};
 
-	// load enviornment variables
-	const char* env_template = getenv("BIGMAAC_TEMPLATE");
-	if (env_template != NULL) {
-		template = strdup(env_template);
+	node* const head = node_new(heap);
+	node* const first = node_new(heap);
+	if (head == NULL || first == NULL) {
+		fprintf(stderr, "BigMalloc heap: failed to make list\n");
+		return NULL;
 	}
 
-	const char* env_min_size_bigmaac = getenv("BIGMAAC_MIN_BIGMAAC_SIZE");
-	if (env_min_size_bigmaac != NULL) {
-		sscanf(env_min_size_bigmaac, "%zu", &min_size_bigmaac);
-	}
+	*head = (node){.size = 0, .ptr = NULL, .next = first, .previous = NULL, .in_use = IN_USE, .heap = heap};
+	*first = (node){.size = size, .ptr = ptr, .next = NULL, .previous = head, .in_use = FREE};
+	heap_insert(head, first);
 
-	const char* env_min_size_fry = getenv("BIGMAAC_MIN_FRY_SIZE");
-	if (env_min_size_fry != NULL) {
-		sscanf(env_min_size_fry, "%zu", &min_size_fry);
-	}
-	if (min_size_fry == 0) {
-		min_size_fry = min_size_bigmaac;  // disabled
-	}
+	return head;
+}
 
-	if (min_size_fry > min_size_bigmaac) {
-		fprintf(stderr, "BigMaac: Failed to initialize library, fries must be smaller than bigmaac, %ld %ld\n", min_size_fry, min_size_bigmaac);
-		load_state = LIBRARY_FAIL;
-		return;
-	}
+// BigMaac metadata
+// Nodes live in anonymous mappings owned by BigMaac, so managing a chunk never calls
+// back into the system allocator. Nodes are carved out of NODE_SLAB_SIZE slabs and recycled through
+// a free list kept per heap, under the same lock as the heap itself.
 
-	const char* env_size_fries = getenv("SIZE_FRIES");
-	if (env_size_fries != NULL) {
-		sscanf(env_size_fries, "%zu", &size_fries);
-	}
-	const char* env_size_bigmaac = getenv("SIZE_BIGMAAC");
-	if (env_size_bigmaac != NULL) {
-		sscanf(env_size_bigmaac, "%zu", &size_bigmaac);
+static void* meta_map(const size_t size) {
+	void* const p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "BigMaac: failed to map metadata %s\n", strerror(errno));
+		return NULL;
 	}
+	__atomic_fetch_add(&active_mmaps, 1, __ATOMIC_RELAXED);
+	return p;
+}
 
-	const size_t size_total = size_fries + size_bigmaac;
-	base_fries = mmap(NULL, size_total, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);  // reserve the full contiguous range
-	if (base_fries == MAP_FAILED) {
-		fprintf(stderr, "BigMaac: Failed to initialize library %s\n", strerror(errno));
-		load_state = LIBRARY_FAIL;
-		pthread_mutex_unlock(&lock);
+static void meta_unmap(void* const ptr, const size_t size) {
+	if (munmap(ptr, size) != 0) {
+		fprintf(stderr, "BigMaac: failed to unmap metadata %s\n", strerror(errno));
 		return;
 	}
-	active_mmaps++;
+	__atomic_fetch_sub(&active_mmaps, 1, __ATOMIC_RELAXED);
+}
 
-	const int ret = mmap_tmpfile(base_fries, size_fries);  // allocate fries right away
-	if (ret < 0) {
-		fprintf(stderr, "BigMaac: Failed to initialize library\n");
-		load_state = LIBRARY_FAIL;
-		pthread_mutex_unlock(&lock);
-		return;
+static node* node_new(heap* const heap) {
+	if (heap->free_nodes == NULL) {
+		node* const slab = (node*)meta_map(NODE_SLAB_SIZE);
+		if (slab == NULL) {
+			return NULL;
+		}
+		const size_t n = NODE_SLAB_SIZE / sizeof(node);
+		for (size_t i = 0; i < n; i++) {
+			slab[i].next = i + 1 < n ? slab + i + 1 : NULL;
+		}
+		heap->free_nodes = slab;
 	}
+	node* const n = heap->free_nodes;
+	heap->free_nodes = n->next;
+	return n;
+}
 
-	end_fries = ((char*)base_fries) + size_fries;
+static void node_delete(heap* const heap, node* const n) {
+	n->next = heap->free_nodes;
+	heap->free_nodes = n;
+}
 
-	base_bigmaac = end_fries;
-	end_bigmaac = ((char*)base_fries) + size_total;
+// BigMaac address index
+// Every in use chunk starts on a fry_size_multiple (fries) or page (bigmaacs) boundary, so a flat
+// table with one slot per boundary maps a pointer straight to its node. The table is reserved with
+// MAP_NORESERVE and only the pages covering live chunks ever get touched.
+
+static int index_init(void) {
+	const size_t n_fries = size_fries / fry_size_multiple + 1;
+	const size_t n_bigmaacs = size_bigmaac / page_size + 1;
+	const size_t size_index = SIZE_TO_MULTIPLE(sizeof(node*) * (n_fries + n_bigmaacs), page_size);
 
-	// initialize a heap
-	_head_bigmaacs = ll_new(base_bigmaac, size_bigmaac);
-	_head_fries = ll_new(base_fries, size_fries);
+	void* const p = mmap(NULL, size_index, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "BigMaac: Failed to reserve address index %s\n", strerror(errno));
+		return -1;
+	}
+	__atomic_fetch_add(&active_mmaps, 1, __ATOMIC_RELAXED);
 
-	load_state = LOADED;
-	pthread_mutex_unlock(&lock);
+	index_fries = (node**)p;
+	index_bigmaacs = index_fries + n_fries;
+	return 0;
 }
 
-// BigMaac helper functions
+FORCE_INLINE node** index_slot(void* const ptr) {
+	if (ptr < base_bigmaac) {
+		return index_fries + ((char*)ptr - (char*)base_fries) / fry_size_multiple;
+	}
+	return index_bigmaacs + ((char*)ptr - (char*)base_bigmaac) / page_size;
+}
 
-static int mmap_tmpfile(void* const ptr, const size_t size) {
-	char* const filename = (char*)real_malloc(sizeof(char) * (strlen(template) + 1));
-	if (filename == NULL) {
-		fprintf(stderr, "Bigmaac: failed to allocate memory in mmap_tmpfile\n");
-		return -1;
+// the in use chunk ptr points anywhere into, or NULL, caller holds a->lock. Only the slot of its start is
+// set, so this looks back from ptr to the nearest set slot, past a->fresh nothing was ever handed out
+static node* index_find_chunk(arena* const a, char* const ptr) {
+	if (ptr < a->base || ptr >= a->fresh) {
+		return NULL;
 	}
-	strcpy(filename, template);
-	fprintf(stderr, "BIGMAAC: make file %0.2f MB\n", ((double)size) / (1024.0 * 1024.0));
-	const int fd = mkstemp(filename);
-	if (fd < 0) {
-		fprintf(stderr, "Bigmaac: Failed to make temp file %s\n", strerror(errno));
-		real_free((size_t)filename);
-		return -1;
+	node** const first = index_slot(a->base);
+	for (node** slot = index_slot(ptr); slot >= first; slot--) {
+		node* const n = *slot;
+		if (n != NULL) {
+			return n->in_use == IN_USE && n->ptr <= ptr && ptr < n->ptr + n->size ? n : NULL;
+		}
 	}
+	return NULL;
+}
 
-	int ret = unlink(filename);
-	if (ret != 0) {
-		fprintf(stderr, "BigMaac: unlink tmpfile failed! %s\n", strerror(errno));
-		real_free((size_t)filename);
-		return -1;
-	}
-	real_free((size_t)filename);
+// BigMaac arenas
+// Each arena owns a contiguous part of the reserved range together with its own heap and lock.
+// Fries are spread over several sub-arenas, a thread sticks to the one it was handed first and
+// only falls over to the others when that one is full.
 
-	ret = ftruncate(fd, size);  // resize the file
-	if (ret != 0) {
-		fprintf(stderr, "BigMaac: ftruncate failed! %s\n", strerror(errno));
-		return -1;
-	}
-	void* ret_ptr = mmap(ptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
-	if (ret_ptr == MAP_FAILED) {
-		fprintf(stderr, "BigMaac: mmap failed! mmap() [ active mmaps %d , bigmaac capacity free: %0.2f , fries capacity free: %0.2f, check /proc/sys/vm/max_map_count : %s\n", active_mmaps,
-		        1.0 - ((float)used_fries) / size_fries, 1.0 - ((float)used_bigmaacs) / size_bigmaac, strerror(errno));
+static int arena_init(arena* const a, void* const base, const size_t size) {
+	if (pthread_mutex_init(&a->lock, NULL) != 0) {
 		return -1;
 	}
-	active_mmaps++;
-
-	ret = close(fd);  // mmap keeps the fd open now
-	if (ret == -1) {
-		fprintf(stderr, "BigMaac: close fd failed! %s\n", strerror(errno));
+	a->head = ll_new(&a->heap, base, size);
+	if (a->head == NULL) {
 		return -1;
 	}
-
+	a->base = (char*)base;
+	a->end = (char*)base + size;
+	a->fresh = (char*)base;
+	a->used = 0;
+	a->lock_wait_ns = 0;
 	return 0;
 }
 
-static void* create_chunk(size_t size) {
-	node* const head = size > min_size_bigmaac ? _head_bigmaacs : _head_fries;  // TODO lock per head?
-	pthread_mutex_lock(&lock);                                                  // keep lock here so that verify is consistent
-	// page align the size requested
-	if (head == _head_bigmaacs) {
-		size = SIZE_TO_MULTIPLE(size, page_size);
-		used_bigmaacs += size;
-	} else {
-		size = SIZE_TO_MULTIPLE(size, fry_size_multiple);
-		used_fries += size;
-	}
-
-	node* heap_chunk = heap_pop_split(head, size);
-	pthread_mutex_unlock(&lock);
-
-	if (heap_chunk == NULL) {
-		return NULL;
+// alignment is 0 or a multiple of what chunks of the arena are aligned to anyway
+// dirty is set to how many leading bytes of the chunk may still hold data from earlier use
+static node* arena_pop(arena* const a, const size_t size, const size_t alignment, size_t* const dirty) {
+	arena_lock(a);  // keep lock here so that verify is consistent
+	verify_memory(a, 0);
+	node* const n = alignment > 0 ? heap_pop_aligned(a->head, size, alignment) : heap_pop_split(a->head, size);
+	if (n != NULL) {
+		a->used += n->size;
+		*index_slot(n->ptr) = n;
+		rss_born(n);
+		if (dirty != NULL) {
+			*dirty = a->fresh <= n->ptr ? 0 : a->fresh - n->ptr < n->size ? a->fresh - n->ptr : n->size;
+		}
+		if (a->fresh < n->ptr + n->size) {
+			a->fresh = n->ptr + n->size;
+		}
 	}
+	verify_memory(a, 1);
+	pthread_mutex_unlock(&a->lock);
+	return n;
+}
 
-	if (head == _head_bigmaacs) {
-		int ret = mmap_tmpfile(heap_chunk->ptr, size);
-		if (ret < 0) {
-			return NULL;
+static int arena_pop_batch(arena* const a, const size_t size, node** const nodes, const int count) {
+	arena_lock(a);
+	verify_memory(a, 0);
+	int i = 0;
+	for (; i < count; i++) {
+		node* const n = heap_pop_split(a->head, size);
+		if (n == NULL) {
+			break;
+		}
+		n->in_use = CACHED;  // goes into a bin
+		a->used += size;
+		*index_slot(n->ptr) = n;
+		rss_born(n);
+		if (a->fresh < n->ptr + size) {
+			a->fresh = n->ptr + size;
 		}
+		nodes[i] = n;
 	}
-
-	return heap_chunk->ptr;
+	verify_memory(a, 1);
+	pthread_mutex_unlock(&a->lock);
+	return i;
 }
 
-FORCE_INLINE void memblock_copy(void* const old_ptr, void* const new_ptr, const size_t old_size, const size_t new_size, const bool from_heap) {
-	const size_t m = (old_size < new_size) ? old_size : new_size;
-	memcpy(new_ptr, old_ptr, m);
-#ifdef DEBUG
-	if (from_heap)
-		log_bm("realloc Mmap[%p]%zu <--%ld-- Heap[%p]%zu\n", new_ptr, new_size, m, old_ptr, old_size);
-	else
-		log_bm("realloc Mmap[%p]%zu <--%ld-- Mmap[%p]%zu\n", new_ptr, new_size, m, old_ptr, old_size);
-#endif
+// caller holds a->lock
+static int arena_free_node(arena* const a, node* const n) {
+	a->used -= n->size;
+	*index_slot(n->ptr) = NULL;
+	verify_memory(a, 0);
+	const int r = heap_free_node(a->head, n);
+	verify_memory(a, 1);
+	return r;
 }
 
-static int remove_chunk_with_ptr(void* const ptr, void* const new_ptr, const size_t new_size) {
-	pthread_mutex_lock(&lock);
-
-	node* n = heap_find_node(ptr);
-	if (n == NULL) {
-		fprintf(stderr, "BigMaac: Cannot find node in BigMaac\n");
-		pthread_mutex_unlock(&lock);
-		return 0;
+// take the arena lock, only timing it when it is contended
+FORCE_INLINE void arena_lock(arena* const a) {
+	if (pthread_mutex_trylock(&a->lock) == 0) {
+		return;
 	}
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_mutex_lock(&a->lock);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	a->lock_wait_ns += (end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec;
+}
 
-	if (new_ptr != NULL) {
-		memblock_copy(n->ptr, new_ptr, n->size, new_size, false);
+FORCE_INLINE arena* arena_of(void* const ptr) {
+	if (ptr >= base_bigmaac) {
+		return &arena_bigmaacs;
 	}
+	const size_t idx = ((char*)ptr - (char*)base_fries) / size_fry_arena;
+	return &arena_fries[idx < n_fry_arenas ? idx : n_fry_arenas - 1];  // the last one takes the remainder
+}
 
-	node* head = ptr < base_bigmaac ? _head_fries : _head_bigmaacs;
-	if (head == _head_bigmaacs) {
-		const void* remap = mmap(n->ptr, n->size, PROT_NONE, MAP_ANONYMOUS | MAP_FIXED | MAP_PRIVATE, -1, 0);
-		if (remap == MAP_FAILED) {
-			fprintf(stderr, "BigMaac: wrong with munmap()! %s\n", strerror(errno));
-			pthread_mutex_unlock(&lock);
-			return 0;
+// the node a thread first allocated on, 0 without BIGMAAC_NUMA
+FORCE_INLINE int numa_node_for_thread(void) {
+	if (thread_numa_node < 0) {
+		unsigned cpu = 0, node = 0;
+#if defined(BIGMAAC_NUMA)
+		if (n_numa_nodes > 1 && syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+			node = 0;
 		}
-		active_mmaps--;
-		used_bigmaacs -= n->size;
-	} else {
-		used_fries -= n->size;
+#endif
+		thread_numa_node = node < (unsigned)n_numa_nodes ? (int)node : 0;
 	}
+	return thread_numa_node;
+}
 
-	verify_memory(head, 0);
-	const int r = heap_free_node(head, n);
-	verify_memory(head, 1);
-	pthread_mutex_unlock(&lock);
-
-	if (r < 0) {
-		return r;
+// sub-arena i belongs to node i % n_numa_nodes, threads are spread over the ones of their node
+FORCE_INLINE int fry_arena_for_thread(void) {
+	if (thread_fry_arena < 0) {
+		const int per_node = n_fry_arenas / n_numa_nodes > 0 ? n_fry_arenas / n_numa_nodes : 1;
+		const int k = __atomic_fetch_add(&next_fry_arena, 1, __ATOMIC_RELAXED) % per_node;
+		thread_fry_arena = (numa_node_for_thread() + k * n_numa_nodes) % n_fry_arenas;
 	}
-
-	return 1;
+	return thread_fry_arena;
 }
 
-// BigMaac C library memory functions
+// sizes above fry are managed by BigMaac, those above bigmaac become bigmaacs, as a BIGMAAC_FORCE_ flag has it
+static void force_thresholds(const int flags, size_t* const fry, size_t* const bigmaac) {
+	if (flags & BIGMAAC_FORCE_BIGMAAC) {
+		*fry = 0;
+		*bigmaac = 0;
+	} else if (flags & BIGMAAC_FORCE_FRY) {
+		*fry = 0;
+		*bigmaac = SIZE_MAX;
+	} else if (flags & BIGMAAC_FORCE_DISK) {
+		*fry = 0;
+	} else if (flags & BIGMAAC_FORCE_RAM) {
+		*fry = SIZE_MAX;
+		*bigmaac = SIZE_MAX;
+	}
+}
 
-void* PREFIX(malloc)(size_t size) {
-	if (load_state == NOT_LOADED && real_malloc == NULL) {
-		bigmaac_init();
+// the thresholds the calling thread allocates by, its innermost bigmaac_scope_begin() has the last word
+FORCE_INLINE void thread_thresholds(size_t* const fry, size_t* const bigmaac) {
+	*fry = __atomic_load_n(&min_size_fry, __ATOMIC_RELAXED);
+	*bigmaac = __atomic_load_n(&min_size_bigmaac, __ATOMIC_RELAXED);
+	if (__builtin_expect(scopes_active > 0, 0) && thread_scope_depth > 0) {
+		force_thresholds(thread_scopes[thread_scope_depth - 1], fry, bigmaac);
 	}
+}
 
-	if (load_state != LOADED || size == 0) {
-		return real_malloc(size);
+// BigMaac thread cache
+// Fries up to tcache_max_size are kept per thread in one bin per size class after free(), and handed
+// out again by malloc() without taking any lock. The cached chunks stay taken as far as the arenas are
+// concerned, but are marked CACHED so that a second free() or a lookup of the pointer is turned down.
+// Bins are refilled and drained TCACHE_BATCH chunks at a time.
+
+static tcache_bin* tcache_for_thread(void) {
+	if (thread_tcache == NULL && n_tcache_bins > 0) {
+		thread_tcache = (tcache_bin*)meta_map(sizeof(tcache_bin) * n_tcache_bins);  // zero filled
+		if (thread_tcache != NULL) {
+			pthread_setspecific(tcache_key, thread_tcache);  // drained on thread exit
+		}
 	}
+	return thread_tcache;
+}
 
-	if (size > min_size_fry) {
-		void* p = create_chunk(size);
-		if (p == NULL) {
-			OOM();
-			return NULL;
+static void tcache_drain(tcache_bin* const bin, const int count) {
+	arena* a = NULL;
+	for (int i = 0; i < count && bin->count > 0; i++) {
+		node* const n = bin->nodes[--bin->count];
+		arena* const next = arena_of(n->ptr);
+		if (next != a) {  // chunks freed by this thread may come from any sub-arena
+			if (a != NULL) {
+				pthread_mutex_unlock(&a->lock);
+			}
+			a = next;
+			arena_lock(a);
 		}
-		return p;
+		n->in_use = IN_USE;
+		if (arena_free_node(a, n) < 0) {
+			fprintf(stderr, "BigMaac: failed to drain thread cache\n");
+		}
+	}
+	if (a != NULL) {
+		pthread_mutex_unlock(&a->lock);
 	}
+}
 
-	return real_malloc(size);
+static void tcache_destroy(void* const tc) {
+	tcache_bin* const bins = (tcache_bin*)tc;
+	thread_tcache = NULL;
+	for (size_t i = 0; i < n_tcache_bins; i++) {
+		tcache_drain(&bins[i], TCACHE_BIN_SIZE);
+	}
+	meta_unmap(bins, sizeof(tcache_bin) * n_tcache_bins);
 }
 
-void* PREFIX(calloc)(size_t count, size_t size) {
-	if (load_state > NOT_LOADED && load_state < LOADED) {
+static void* tcache_get(const size_t size) {
+	tcache_bin* const bins = tcache_for_thread();
+	if (bins == NULL) {
 		return NULL;
 	}
+	tcache_bin* const bin = &bins[size / fry_size_multiple - 1];
+	if (bin->count == 0) {
+		bin->count = arena_pop_batch(&arena_fries[fry_arena_for_thread()], size, bin->nodes, TCACHE_BATCH);
+		if (bin->count == 0) {
+			return NULL;  // let the caller look through the other sub-arenas
+		}
+	}
+	node* const n = bin->nodes[--bin->count];
+	n->in_use = IN_USE;
+	return n->ptr;
+}
+
+static bool tcache_put(void* const ptr) {
+	// the node is in use and owned by the caller, so it can be looked at without a lock
+	node* const n = heap_find_node(ptr);
+	if (n != NULL && n->in_use == CACHED) {
+		fprintf(stderr, "BigMaac: double free of %p\n", ptr);
+		return true;  // it is in a bin already
+	}
+	if (n == NULL || n->in_use != IN_USE || n->size > tcache_max_size) {
+		return false;
+	}
+	tcache_bin* const bins = tcache_for_thread();
+	if (bins == NULL) {
+		return false;
+	}
+	tcache_bin* const bin = &bins[n->size / fry_size_multiple - 1];
+	if (bin->count == TCACHE_BIN_SIZE) {
+		tcache_drain(bin, TCACHE_BATCH);
+	}
+	n->in_use = CACHED;
+	bin->nodes[bin->count++] = n;
+	return true;
+}
+
+// BigMaac
+
+#if !defined(NOTCOMPAT)
+// loads the preloaded library when it is loaded, or before that on the first allocation of whoever comes first,
+// a NOTCOMPAT build only reserves its arenas on the first bigmaac_ call
+__attribute__((constructor)) static void bigmaac_constructor(void) { init_wait(); }
+#endif
+
+// the slow path of every entry point, true once BigMaac is loaded, another thread loading it is waited for
+static bool init_wait(void) {
+	const enum load_status state = __atomic_load_n(&load_state, __ATOMIC_ACQUIRE);
+	if (state == LOADED || state == LIBRARY_FAIL || thread_initializing) {
+		return state == LOADED;
+	}
+	bigmaac_init();
+	return __atomic_load_n(&load_state, __ATOMIC_ACQUIRE) == LOADED;
+}
+
+// sizes no thread needs BigMaac for, none before it is loaded, all if it failed to and without scopes the fries cutoff
+static void pass_through_update(void) {
+	pthread_mutex_lock(&pass_through_lock);
+	const enum load_status state = __atomic_load_n(&load_state, __ATOMIC_ACQUIRE);
+	size_t below = 0;
+	if (state == LIBRARY_FAIL) {
+		below = SIZE_MAX;
+	} else if (state == LOADED && __atomic_load_n(&scopes_active, __ATOMIC_RELAXED) == 0) {
+		below = __atomic_load_n(&min_size_fry, __ATOMIC_RELAXED) + 1;
+	}
+	__atomic_store_n(&pass_through_below, below, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&pass_through_lock);
+}
+
+static void init_done(const enum load_status state) {
+	__atomic_store_n(&load_state, state, __ATOMIC_RELEASE);
+	pass_through_update();
+	thread_initializing = false;
+	pthread_mutex_unlock(&init_lock);
+}
+
+static void bigmaac_init(void) {
+	pthread_mutex_lock(&init_lock);
+	if (__atomic_load_n(&load_state, __ATOMIC_ACQUIRE) != NOT_LOADED) {  // loaded or failed while we waited
+		pthread_mutex_unlock(&init_lock);
+		return;
+	}
+	thread_initializing = true;
+	fprintf(stderr, "Loading Bigmaac Heap X! PID:%d PPID:%d\n", getpid(), getppid());
+	__atomic_store_n(&load_state, LOADING_MEM_FUNCS, __ATOMIC_RELAXED);
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+	real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+	real_memalign = dlsym(RTLD_NEXT, "memalign");
+	real_malloc_usable_size = dlsym(RTLD_NEXT, MALLOCSIZE);
+	// real_reallocarray = dlsym(RTLD_NEXT, "reallocarray");
+	if (!real_malloc || !real_free || !real_calloc || !real_realloc || !real_posix_memalign || !real_malloc_usable_size /* || !real_reallocarray*/) {
+		fprintf(stderr, "Error in `dlsym`: %s\n", dlerror());
+	}
+	__atomic_store_n(&load_state, LOADING_LIBRARY, __ATOMIC_RELAXED);
+
+	log_bm("OPEN LIB\n");
+
+	page_size = sysconf(_SC_PAGE_SIZE);
+	bigmaac_multiple = page_size;
+
+	// load enviornment variables
+	const char* env_template = getenv("BIGMAAC_TEMPLATE");
+	for (const char* t = env_template == NULL ? DEFAULT_TEMPLATE : env_template; *t != '\0' && n_templates < MAX_TEMPLATES;) {
+		const size_t length = strcspn(t, ":");  // a list of templates, one per swap partition
+		if (length > 0) {
+			char* const path = strndup(t, length);
+			const char* const slash = strrchr(path, '/');
+			templates[n_templates++] = (swap_template){.path = path,
+			                                           .dir = slash == NULL ? strdup(".") : slash == path ? strdup("/") : strndup(path, slash - path),
+			                                           .no_tmpfile = false,
+			                                           .numa_node = -1};
+		}
+		t += length + (t[length] == ':');
+	}
+	if (n_templates == 0) {
+		templates[n_templates++] = (swap_template){.path = DEFAULT_TEMPLATE, .dir = "/tmp", .no_tmpfile = false, .numa_node = -1};
+	}
+	for (int i = 0; i < n_templates; i++) {
+		struct stat dir;
+		templates[i].dev = stat(templates[i].dir, &dir) == 0 ? dir.st_dev : 0;
+	}
+	const char* env_placement = getenv("BIGMAAC_PLACEMENT");
+	if (env_placement != NULL) {
+		if (strcmp(env_placement, "mostfree") == 0) {
+			placement = PLACEMENT_MOST_FREE;
+		} else if (strcmp(env_placement, "roundrobin") != 0) {
+			fprintf(stderr, "BigMaac: unknown BIGMAAC_PLACEMENT %s, using roundrobin\n", env_placement);
+		}
+	}
+	const char* env_stripe_size = getenv("BIGMAAC_STRIPE_SIZE");
+	if (env_stripe_size != NULL) {
+		sscanf(env_stripe_size, "%zu", &stripe_size);
+	}
+
+	const char* env_advise_fries = getenv("BIGMAAC_ADVISE_FRIES");
+	if (env_advise_fries != NULL && (advice_fries = advice_parse(env_advise_fries)) < 0) {
+		fprintf(stderr, "BigMaac: unknown BIGMAAC_ADVISE_FRIES %s\n", env_advise_fries);
+		advice_fries = BIGMAAC_NORMAL;
+	}
+	const char* env_advise_bigmaacs = getenv("BIGMAAC_ADVISE_BIGMAACS");
+	if (env_advise_bigmaacs != NULL && (advice_bigmaacs = advice_parse(env_advise_bigmaacs)) < 0) {
+		fprintf(stderr, "BigMaac: unknown BIGMAAC_ADVISE_BIGMAACS %s\n", env_advise_bigmaacs);
+		advice_bigmaacs = BIGMAAC_NORMAL;
+	}
+
+	const char* env_hugepages = getenv("BIGMAAC_HUGEPAGES");
+	if (env_hugepages != NULL) {
+		if (strcmp(env_hugepages, "thp") == 0) {
+			hugepages = HUGEPAGES_THP;
+		} else if (strcmp(env_hugepages, "hugetlb") == 0) {
+			hugepages = HUGEPAGES_HUGETLB;
+			map_shared = MAP_SHARED | MAP_NORESERVE;  // the arenas are far bigger than any huge page pool
+		} else if (strcmp(env_hugepages, "off") != 0) {
+			fprintf(stderr, "BigMaac: unknown BIGMAAC_HUGEPAGES %s, huge pages are off\n", env_hugepages);
+		}
+	}
+	if (hugepages != HUGEPAGES_OFF) {
+		bigmaac_multiple = hugepage_size();
+	}
+
+	const char* env_backing = getenv("BIGMAAC_BACKING");
+	if (env_backing != NULL) {
+		if (strcmp(env_backing, "template") == 0) {
+			backing = BACKING_TEMPLATE;
+		} else if (strcmp(env_backing, "tmpfile") == 0) {
+			backing = BACKING_TMPFILE;
+		} else if (strcmp(env_backing, "memfd") == 0) {
+			backing = BACKING_MEMFD;
+		} else {
+			fprintf(stderr, "BigMaac: unknown BIGMAAC_BACKING %s, using the template\n", env_backing);
+			backing = BACKING_TEMPLATE;
+		}
+	}
+
+	const char* env_io_engine = getenv("BIGMAAC_IO_ENGINE");
+	if (env_io_engine != NULL) {
+		if (strcmp(env_io_engine, "uring") == 0) {
+			io_engine = IO_ENGINE_URING;
+		} else if (strcmp(env_io_engine, "sync") != 0) {
+			fprintf(stderr, "BigMaac: unknown BIGMAAC_IO_ENGINE %s, hints stay synchronous\n", env_io_engine);
+		}
+	}
+	const char* env_io_depth = getenv("BIGMAAC_IO_DEPTH");
+	if (env_io_depth != NULL) {
+		sscanf(env_io_depth, "%d", &io_depth);
+	}
+	io_depth = io_depth < 1 ? 1 : io_depth > MAX_IO_DEPTH ? MAX_IO_DEPTH : io_depth;
+
+	const char* env_min_size_bigmaac = getenv("BIGMAAC_MIN_BIGMAAC_SIZE");
+	if (env_min_size_bigmaac != NULL) {
+		sscanf(env_min_size_bigmaac, "%zu", &min_size_bigmaac);
+	}
+
+	const char* env_min_size_fry = getenv("BIGMAAC_MIN_FRY_SIZE");
+	if (env_min_size_fry != NULL) {
+		sscanf(env_min_size_fry, "%zu", &min_size_fry);
+	}
+	if (min_size_fry == 0) {
+		min_size_fry = min_size_bigmaac;  // disabled
+	}
+
+	if (min_size_fry > min_size_bigmaac) {
+		fprintf(stderr, "BigMaac: Failed to initialize library, fries must be smaller than bigmaac, %ld %ld\n", min_size_fry, min_size_bigmaac);
+		init_done(LIBRARY_FAIL);
+		return;
+	}
+
+	const char* env_size_fries = getenv("SIZE_FRIES");
+	if (env_size_fries != NULL) {
+		sscanf(env_size_fries, "%zu", &size_fries);
+	}
+	const char* env_size_bigmaac = getenv("SIZE_BIGMAAC");
+	if (env_size_bigmaac != NULL) {
+		sscanf(env_size_bigmaac, "%zu", &size_bigmaac);
+	}
+	const char* env_fry_arenas = getenv("BIGMAAC_FRY_ARENAS");
+	if (env_fry_arenas != NULL) {
+		sscanf(env_fry_arenas, "%d", &n_fry_arenas);
+	}
+	if (n_fry_arenas < 1) {
+		n_fry_arenas = 1;
+	} else if (n_fry_arenas > MAX_FRY_ARENAS) {
+		n_fry_arenas = MAX_FRY_ARENAS;
+	}
+	const char* env_numa = getenv("BIGMAAC_NUMA");
+	if (env_numa != NULL) {
+		numa = strcmp(env_numa, "0") != 0;
+	}
+	if (numa) {
+		numa_init();
+	}
+	const char* env_tcache_max_size = getenv("BIGMAAC_TCACHE_MAX_SIZE");
+	if (env_tcache_max_size != NULL) {
+		sscanf(env_tcache_max_size, "%zu", &tcache_max_size);
+	}
+	if (tcache_max_size > min_size_bigmaac) {
+		tcache_max_size = min_size_bigmaac;  // bigmaacs are never cached
+	}
+	tcache_max_size -= tcache_max_size % fry_size_multiple;
+	n_tcache_bins = tcache_max_size / fry_size_multiple;
+	if (n_tcache_bins > 0 && pthread_key_create(&tcache_key, tcache_destroy) != 0) {
+		n_tcache_bins = 0;
+		tcache_max_size = 0;
+	}
+
+	const char* env_file_pool = getenv("BIGMAAC_FILE_POOL");
+	if (env_file_pool != NULL) {
+		sscanf(env_file_pool, "%d", &file_pool_size);
+	}
+	file_pool_size = file_pool_size < 0 ? 0 : file_pool_size > MAX_FILE_POOL ? MAX_FILE_POOL : file_pool_size;
+	const char* env_extent_cache = getenv("BIGMAAC_EXTENT_CACHE");
+	if (env_extent_cache != NULL) {
+		sscanf(env_extent_cache, "%d", &extent_cache_size);
+	}
+	extent_cache_size = extent_cache_size < 0 ? 0 : extent_cache_size > MAX_EXTENT_CACHE ? MAX_EXTENT_CACHE : extent_cache_size;
+	const char* env_store_files = getenv("BIGMAAC_STORE_FILES");
+	if (env_store_files != NULL) {
+		sscanf(env_store_files, "%d", &n_store_files);
+	}
+	n_store_files = n_store_files < 0 ? 0 : n_store_files > MAX_STORE_FILES ? MAX_STORE_FILES : n_store_files;
+
+	const char* env_stats_interval = getenv("BIGMAAC_STATS_INTERVAL");
+	if (env_stats_interval != NULL) {
+		sscanf(env_stats_interval, "%d", &stats_interval);
+	}
+	const char* env_stats_file = getenv("BIGMAAC_STATS_FILE");
+	if (env_stats_file != NULL) {
+		stats_file = strdup(env_stats_file);
+	}
+
+	const char* env_rss_limit = getenv("BIGMAAC_RSS_LIMIT");
+	if (env_rss_limit != NULL) {
+		sscanf(env_rss_limit, "%zu", &rss_limit);
+	}
+	const char* env_rss_interval = getenv("BIGMAAC_RSS_INTERVAL");
+	if (env_rss_interval != NULL) {
+		sscanf(env_rss_interval, "%d", &rss_interval_ms);
+	}
+	rss_interval_ms = rss_interval_ms < 1 ? 1 : rss_interval_ms;
+	const char* env_tier = getenv("BIGMAAC_COMPRESSED_TIER");
+	if (env_tier != NULL) {
+		sscanf(env_tier, "%zu", &tier_limit);
+	}
+
+	const char* env_adaptive = getenv("BIGMAAC_ADAPTIVE");
+	if (env_adaptive != NULL) {
+		adaptive = strcmp(env_adaptive, "0") != 0;
+	}
+	const char* env_adaptive_interval = getenv("BIGMAAC_ADAPTIVE_INTERVAL");
+	if (env_adaptive_interval != NULL) {
+		sscanf(env_adaptive_interval, "%d", &adaptive_interval_ms);
+	}
+	adaptive_interval_ms = adaptive_interval_ms < 1 ? 1 : adaptive_interval_ms;
+	const char* env_adaptive_low = getenv("BIGMAAC_ADAPTIVE_LOW");
+	if (env_adaptive_low != NULL) {
+		sscanf(env_adaptive_low, "%zu", &adaptive_low);
+	}
+	const char* env_adaptive_high = getenv("BIGMAAC_ADAPTIVE_HIGH");
+	if (env_adaptive_high != NULL) {
+		sscanf(env_adaptive_high, "%zu", &adaptive_high);
+	}
+	adaptive_low = adaptive_low < 1 ? 1 : adaptive_low;
+	adaptive_high = adaptive_high < adaptive_low ? adaptive_low : adaptive_high;
+
+	const char* env_fork = getenv("BIGMAAC_FORK");
+	if (env_fork != NULL) {
+		if (strcmp(env_fork, "shared") == 0) {
+			fork_mode = FORK_SHARED;
+		} else if (strcmp(env_fork, "private") != 0) {
+			fprintf(stderr, "BigMaac: unknown BIGMAAC_FORK %s, children get private copies\n", env_fork);
+		}
+	}
+
+	const char* env_trace_backtrace = getenv("BIGMAAC_TRACE_BACKTRACE");
+	if (env_trace_backtrace != NULL) {
+		sscanf(env_trace_backtrace, "%d", &trace_backtrace);
+	}
+	const char* env_trace = getenv("BIGMAAC_TRACE");
+	if (env_trace != NULL) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s.%d", env_trace, getpid());
+		trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (trace_fd < 0) {
+			fprintf(stderr, "BigMaac: cannot open trace file %s %s\n", path, strerror(errno));
+		} else if (pthread_key_create(&trace_key, trace_release) != 0 || write(trace_fd, TRACE_MAGIC, strlen(TRACE_MAGIC)) < 0) {
+			close(trace_fd);
+			trace_fd = -1;
+		} else {
+			trace_prefix = strdup(env_trace);
+		}
+	}
+
+	const char* env_persist = getenv("BIGMAAC_PERSIST");
+	if (env_persist != NULL && *env_persist != '\0') {
+		// named files in one directory, chunks in the store so the journal covers all of them, and no thread
+		// caches as the chunks in them look the same as those in use
+		persist_dir = strdup(env_persist);
+		char* const path = (char*)real_malloc(strlen(persist_dir) + sizeof("/bigmaac.XXXXXXXX"));
+		sprintf(path, "%s/bigmaac.XXXXXXXX", persist_dir);
+		struct stat dir;
+		templates[0] = (swap_template){.path = path, .dir = persist_dir, .no_tmpfile = false, .dev = stat(persist_dir, &dir) == 0 ? dir.st_dev : 0, .numa_node = -1};
+		n_templates = 1;
+		numa_template_nodes = 0;
+		backing = BACKING_TEMPLATE;
+		n_store_files = n_store_files < 1 ? 1 : n_store_files;
+		tcache_max_size = 0;
+		n_tcache_bins = 0;
+		if (persist_load()) {  // the layout of the journal wins over the environment
+			size_fries = persist_journal->size_fries;
+			size_bigmaac = persist_journal->size_bigmaac;
+			n_fry_arenas = persist_journal->n_fry_arenas;
+			n_store_files = persist_journal->n_store_files;
+		}
+	}
+
+	size_fries = SIZE_TO_MULTIPLE(size_fries, bigmaac_multiple);
+	size_bigmaac = SIZE_TO_MULTIPLE(size_bigmaac, bigmaac_multiple);
+	size_fry_arena = size_fries / n_fry_arenas / page_size * page_size;
+	if (size_fry_arena == 0) {
+		n_fry_arenas = 1;
+		size_fry_arena = size_fries;
+	}
+
+	const size_t size_total = size_fries + size_bigmaac;
+	char* reserved = MAP_FAILED;
+	if (persist_journal != NULL) {  // where it was before, the pointers in the data depend on it
+		char* const base = (char*)(uintptr_t)persist_journal->base;
+#if defined(MAP_FIXED_NOREPLACE)
+		reserved = mmap(base, size_total, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED_NOREPLACE, -1, 0);
+#else
+		reserved = mmap(base, size_total, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+#endif
+		if (reserved != MAP_FAILED && reserved != base) {
+			munmap(reserved, size_total);
+			reserved = MAP_FAILED;
+			errno = EEXIST;
+		}
+		if (reserved == MAP_FAILED) {  // the files and the journal are left for the next start
+			fprintf(stderr, "BigMaac: %p is taken, not restoring %s %s\n", base, persist_dir, strerror(errno));
+			meta_unmap(persist_journal, persist_journal_size);
+			persist_journal = NULL;
+			persist_dir = NULL;
+		}
+	}
+	if (reserved == MAP_FAILED) {  // reserve the full contiguous range, with some slack to align it for huge pages
+		reserved = mmap(NULL, size_total + bigmaac_multiple - page_size, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	}
+	if (reserved == MAP_FAILED) {
+		fprintf(stderr, "BigMaac: Failed to initialize library %s\n", strerror(errno));
+		init_done(LIBRARY_FAIL);
+		return;
+	}
+	__atomic_fetch_add(&active_mmaps, 1, __ATOMIC_RELAXED);
+	base_fries = reserved + (bigmaac_multiple - (uintptr_t)reserved % bigmaac_multiple) % bigmaac_multiple;
+
+	end_fries = ((char*)base_fries) + size_fries;
+
+	base_bigmaac = end_fries;
+	end_bigmaac = ((char*)base_fries) + size_total;
+
+	const int ret = mmap_striped(base_fries, size_fries);  // allocate fries right away
+	if (ret < 0) {
+		fprintf(stderr, "BigMaac: Failed to initialize library\n");
+		init_done(LIBRARY_FAIL);
+		return;
+	}
+
+	if (n_store_files > 0 && store_init() < 0) {
+		fprintf(stderr, "BigMaac: Failed to initialize library\n");
+		init_done(LIBRARY_FAIL);
+		return;
+	}
+	if (hugepages != HUGEPAGES_OFF) {
+		hugepage_report();
+	}
+
+	if (index_init() < 0) {
+		fprintf(stderr, "BigMaac: Failed to initialize library\n");
+		init_done(LIBRARY_FAIL);
+		return;
+	}
+
+	// initialize the heaps
+	int ret_arena = arena_init(&arena_bigmaacs, base_bigmaac, size_bigmaac);
+	for (int i = 0; i < n_fry_arenas && ret_arena == 0; i++) {
+		char* const base = (char*)base_fries + i * size_fry_arena;
+		const size_t size = i == n_fry_arenas - 1 ? (char*)end_fries - base : size_fry_arena;
+		ret_arena = arena_init(&arena_fries[i], base, size);
+		numa_bind(base, size, i % n_numa_nodes);
+	}
+	if (ret_arena < 0) {
+		fprintf(stderr, "BigMaac: Failed to initialize library heaps\n");
+		init_done(LIBRARY_FAIL);
+		return;
+	}
+	if (persist_journal != NULL) {
+		if (persist_restore() < 0) {
+			fprintf(stderr, "BigMaac: Failed to restore %s\n", persist_dir);
+			init_done(LIBRARY_FAIL);
+			return;
+		}
+		fprintf(stderr, "BigMaac: restored %llu chunks from %s\n", (unsigned long long)persist_journal->n_chunks, persist_dir);
+		persist_root = (void*)(uintptr_t)persist_journal->root;
+		meta_unmap(persist_journal, persist_journal_size);
+		persist_journal = NULL;  // the file stays, what it lists is kept until the next journal
+	}
+	if (persist_dir != NULL) {
+		atexit(persist_finish);
+	}
+	struct rlimit files;
+	max_kept_fds = getrlimit(RLIMIT_NOFILE, &files) != 0 ? 0 : files.rlim_cur == RLIM_INFINITY || files.rlim_cur / 4 > INT_MAX ? INT_MAX : (int)(files.rlim_cur / 4);
+	if (pthread_atfork(fork_prepare, fork_parent, fork_child) != 0) {
+		fprintf(stderr, "BigMaac: failed to register the fork handlers, children share memory with the parent\n");
+	}
+
+	init_done(LOADED);
+
+	if (stats_interval > 0 && !thread_start(stats_worker)) {
+		fprintf(stderr, "BigMaac: failed to start the stats thread\n");
+	}
+	if (io_engine == IO_ENGINE_URING && !thread_start(io_worker)) {
+		fprintf(stderr, "BigMaac: failed to start the I/O thread\n");
+		io_engine = IO_ENGINE_SYNC;
+	}
+	if (rss_limit > 0 && tier_limit > 0) {
+		tier_start();
+	}
+	if (rss_limit > 0) {
+		rss_find_cgroup();
+	}
+	if (rss_limit > 0 && !thread_start(rss_worker)) {
+		fprintf(stderr, "BigMaac: failed to start the rss limit thread\n");
+	}
+	if (adaptive && !thread_start(adaptive_worker)) {
+		fprintf(stderr, "BigMaac: failed to start the adaptive thresholds thread\n");
+		adaptive = false;
+	}
+	if (trace_fd >= 0) {
+		if (trace_backtrace > 0) {  // the first backtrace() loads the unwinder, get that over with here
+			void* frame[1];
+			backtrace(frame, 1);
+		}
+		trace_write_maps();
+		atexit(trace_finish);
+		if (!thread_start(trace_worker)) {
+			fprintf(stderr, "BigMaac: failed to start the trace thread\n");
+		}
+	}
+}
+
+// BigMaac backing files
+// Creating a file on the swap partition costs a handful of syscalls and directory updates, so a
+// background thread keeps a few unlinked files ready. It is started with the first bigmaac. With
+// several templates each new file goes to the next one in turn, or with BIGMAAC_PLACEMENT=mostfree to
+// the one with the most free space.
+
+static int template_pick(void) {
+	if (n_templates == 1) {
+		return 0;
+	}
+	// with BIGMAAC_NUMA the templates on a device of the thread's node go first, if it has any
+	const int node = numa_template_nodes >> numa_node_for_thread() & 1 ? numa_node_for_thread() : -1;
+	int candidates[MAX_TEMPLATES] = {0};
+	int n = 0;
+	for (int i = 0; i < n_templates; i++) {
+		if (node < 0 || templates[i].numa_node == node) {
+			candidates[n++] = i;
+		}
+	}
+	if (placement == PLACEMENT_ROUND_ROBIN) {
+		return candidates[(unsigned)__atomic_fetch_add(&next_template, 1, __ATOMIC_RELAXED) % n];
+	}
+	int best = candidates[0];
+	unsigned long long best_free = 0;
+	for (int i = 0; i < n; i++) {
+		struct statvfs fs;
+		const unsigned long long avail = statvfs(templates[candidates[i]].dir, &fs) == 0 ? (unsigned long long)fs.f_bavail * fs.f_frsize : 0;
+		if (avail > best_free) {
+			best = candidates[i];
+			best_free = avail;
+		}
+	}
+	return best;
+}
+
+static int tmpfile_open(void) { return tmpfile_open_at(&templates[template_pick()]); }
+
+static int tmpfile_open_at(swap_template* const t) {
+	if (persist_dir != NULL && __atomic_load_n(&load_state, __ATOMIC_ACQUIRE) != LOADED) {  // the fries and the store files
+		return persist_open();
+	}
+#if defined(__linux__)
+	if (backing == BACKING_MEMFD) {
+		const int fd = memfd_create("bigmaac", MFD_CLOEXEC | (hugepages == HUGEPAGES_HUGETLB ? MFD_HUGETLB : 0));
+		if (fd >= 0) {
+			return fd;
+		}
+		fprintf(stderr, "BigMaac: memfd_create failed, falling back to the template %s\n", strerror(errno));
+		backing = BACKING_TEMPLATE;
+	}
+#endif
+#if defined(O_TMPFILE)
+	if (backing == BACKING_TMPFILE && !t->no_tmpfile) {
+		const int fd = open(t->dir, O_TMPFILE | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);  // never has a name
+		if (fd >= 0) {
+			return fd;
+		}
+		if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL) {
+			fprintf(stderr, "Bigmaac: Failed to make temp file in %s %s\n", t->dir, strerror(errno));
+			return -1;
+		}
+		t->no_tmpfile = true;  // the file system does not know O_TMPFILE
+	}
+#endif
+
+	char* const filename = (char*)real_malloc(sizeof(char) * (strlen(t->path) + 1));
+	if (filename == NULL) {
+		fprintf(stderr, "Bigmaac: failed to allocate memory in tmpfile_open\n");
+		return -1;
+	}
+	strcpy(filename, t->path);
+	const int fd = mkostemp(filename, O_CLOEXEC);  // kept open, exec() does not hand it on
+	if (fd < 0) {
+		fprintf(stderr, "Bigmaac: Failed to make temp file %s\n", strerror(errno));
+		real_free((size_t)filename);
+		return -1;
+	}
+
+	int ret = unlink(filename);
+	if (ret != 0) {
+		fprintf(stderr, "BigMaac: unlink tmpfile failed! %s\n", strerror(errno));
+		real_free((size_t)filename);
+		close(fd);
+		return -1;
+	}
+	real_free((size_t)filename);
+	return fd;
+}
+
+static void* file_pool_worker(void* const arg) {
+	pthread_mutex_lock(&file_pool_lock);
+	for (;;) {
+		while (file_pool_count >= file_pool_size) {
+			pthread_cond_wait(&file_pool_cond, &file_pool_lock);
+		}
+		pthread_mutex_unlock(&file_pool_lock);
+		const int fd = tmpfile_open();
+		pthread_mutex_lock(&file_pool_lock);
+		if (fd < 0) {  // leave it to the allocating threads, they will report the error
+			file_pool_size = 0;
+			break;
+		}
+		file_pool[file_pool_count++] = fd;
+	}
+	pthread_mutex_unlock(&file_pool_lock);
+	return NULL;
+}
+
+static int file_pool_get(void) {
+	if (numa_template_nodes != 0) {  // the pool cannot tell which node the file is for
+		return tmpfile_open();
+	}
+	int fd = -1;
+	pthread_mutex_lock(&file_pool_lock);
+	if (!file_pool_started && file_pool_size > 0 && __atomic_load_n(&load_state, __ATOMIC_ACQUIRE) == LOADED) {
+		file_pool_started = true;
+		if (!thread_start(file_pool_worker)) {
+			file_pool_size = 0;
+		}
+	}
+	if (file_pool_count > 0) {
+		fd = file_pool[--file_pool_count];
+		pthread_cond_signal(&file_pool_cond);
+	}
+	pthread_mutex_unlock(&file_pool_lock);
+
+	return fd < 0 ? tmpfile_open() : fd;
+}
+
+// BigMaac freed extents
+// A freed bigmaac backed by a single mapping stays mapped, its pages are punched out of the file so
+// it reads as zero again and costs no disk. The next bigmaac that fits takes it over without touching
+// the file system, the oldest one is really freed when the cache is full.
+
+static bool extent_put(void* const ptr) {
+#if defined(MADV_REMOVE)
+	// the node is in use and owned by the caller, so it can be looked at without a lock
+	node* const n = heap_find_node(ptr);
+	if (extent_cache_size == 0 || n == NULL || n->maps != 1 || n->inherited || n->exported) {
+		return false;
+	}
+	tier_begin(n->ptr, n->size, false);
+	const int removed = madvise(n->ptr, n->size, MADV_REMOVE);
+	tier_end();
+	if (removed != 0) {
+		return false;
+	}
+
+	node* evict = NULL;
+	arena_lock(&arena_bigmaacs);
+	if (extent_cache_count == extent_cache_size) {
+		evict = extent_cache[0];
+		memmove(extent_cache, extent_cache + 1, sizeof(node*) * --extent_cache_count);
+	}
+	extent_cache[extent_cache_count++] = n;
+	pthread_mutex_unlock(&arena_bigmaacs.lock);
+
+	if (evict != NULL && remove_chunk_with_ptr(evict->ptr, NULL, 0) != 1) {
+		fprintf(stderr, "BigMaac: is missing memory address it should have\n");
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+static void* extent_get(const size_t size) {
+	arena_lock(&arena_bigmaacs);
+	int best = -1;
+	for (int i = 0; i < extent_cache_count; i++) {
+		if (extent_cache[i]->size >= size && (best < 0 || extent_cache[i]->size < extent_cache[best]->size)) {
+			best = i;
+		}
+	}
+	node* const n = best < 0 ? NULL : extent_cache[best];
+	if (n != NULL) {
+		memmove(extent_cache + best, extent_cache + best + 1, sizeof(node*) * (--extent_cache_count - best));
+		rss_born(n);
+	}
+	pthread_mutex_unlock(&arena_bigmaacs.lock);
+
+	if (n == NULL) {
+		return NULL;
+	}
+	shrink_chunk(n->ptr, size);  // give back what is too much
+	return n->ptr;
+}
+
+// BigMaac consolidated store
+// With BIGMAAC_STORE_FILES set the bigmaac arena is mapped up front, like the fries, by that many
+// sparse files each covering an equal slice. Bigmaacs are then just ranges of the store and cost no
+// file, no mapping and no VMA of their own, freed ranges are punched out of the files.
+
+static int store_init(void) {
+#if defined(MADV_REMOVE)
+	const size_t size_slice = size_bigmaac / n_store_files / bigmaac_multiple * bigmaac_multiple;
+	for (int i = 0; i < n_store_files; i++) {
+		char* const base = (char*)base_bigmaac + i * size_slice;
+		if (mmap_striped(base, i == n_store_files - 1 ? (char*)end_bigmaac - base : size_slice) < 0) {
+			return -1;
+		}
+	}
+	if (persist_journal == NULL && madvise(base_bigmaac, bigmaac_multiple, MADV_REMOVE) != 0) {  // a restored store has data there
+		fprintf(stderr, "BigMaac: swap partition cannot punch holes, no consolidated store %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+#else
+	fprintf(stderr, "BigMaac: no consolidated store on this platform\n");
+	return -1;
+#endif
+}
+
+// give back the range of a bigmaac, punched out of the store or returned to the reservation
+static int unmap_chunk(node* const n, char* const ptr, const size_t size) {
+	const bool whole = ptr == n->ptr && size == n->size;  // unmapping all of its own files frees them anyway
+	tier_begin(ptr, size, false);
+	// store space inherited from the parent goes back to the files of this process, if it has its own
+	const bool own = !n->inherited || (n->maps == 0 && stripes_map(ptr, size, map_shared) == 0);
+#if defined(MADV_REMOVE)
+	if ((n->maps == 0 || !whole) && own && madvise(ptr, size, MADV_REMOVE) != 0 && errno != EOPNOTSUPP) {
+		fprintf(stderr, "BigMaac: madvise(MADV_REMOVE) failed! %s\n", strerror(errno));
+		if (n->maps == 0) {
+			tier_end();
+			return -1;
+		}
+	}
+#endif
+	if (n->maps == 0) {
+		tier_end();
+		return 0;
+	}
+
+	// an import placed over the store gives its range back to the store
+	const void* remap = n_store_files > 0 && stripes_map(ptr, size, map_shared) == 0 ? ptr : mmap(ptr, size, PROT_NONE, MAP_ANONYMOUS | MAP_FIXED | MAP_PRIVATE, -1, 0);
+	tier_end();
+	if (remap == MAP_FAILED) {
+		fprintf(stderr, "BigMaac: wrong with munmap()! %s\n", strerror(errno));
+		return -1;
+	}
+	if (whole) {  // all of its mappings are gone
+		__atomic_fetch_sub(&active_mmaps, n->maps, __ATOMIC_RELAXED);
+		fd_drop(n->fd);
+		n->fd = -1;
+	}
+	return 0;
+}
+
+// BigMaac fork
+// The mappings are shared, so a child of fork() would write into the files of its parent and hand out the
+// same free space. Around fork() every lock is taken, so the child starts from a consistent copy of the
+// heaps, and the compressed tier is copied back into the files first. With BIGMAAC_FORK=private the child
+// gets a copy of each file it inherits and goes on as a BigMaac process of its own: a clone (FICLONE, on
+// XFS, btrfs and the like blocks are shared until either side writes them) where the file system can,
+// else its data is copied, holes are skipped. The parent waits in fork() with its locks held until the
+// child is done, so nothing it frees or reuses shows up in the copies. A file that cannot be copied is
+// mapped MAP_PRIVATE, the child still sees later writes of the parent to pages it did not write itself,
+// and the parent pins everything in use so none of it is punched, cached or recycled under the child.
+// With BIGMAAC_FORK=shared, and for bigmaac_share() bigmaacs, the child keeps the parent's mappings.
+// Chunks a child keeps in the files of its parent are inherited, they are never punched, resized or
+// grown in place, and a child without fries or a store of its own makes bigmaacs with files of their
+// own. Helper threads do not survive fork(), the child starts its own.
+
+static void fork_prepare(void) {
+	pthread_mutex_lock(&init_lock);
+	pthread_mutex_lock(&pass_through_lock);
+	pthread_mutex_lock(&tier_lock);
+	pthread_mutex_lock(&arena_bigmaacs.lock);
+	for (int i = 0; i < n_fry_arenas; i++) {
+		pthread_mutex_lock(&arena_fries[i].lock);
+	}
+	tier_restore();  // a child cannot fault pages in from the tier of its parent
+	pthread_mutex_lock(&file_pool_lock);
+	pthread_mutex_lock(&io_lock);
+	pthread_mutex_lock(&trace_lock);
+#ifdef DEBUG
+	pthread_mutex_lock(&log_lock);
+#endif
+	if (fork_mode == FORK_PRIVATE && pipe2(fork_pipe, O_CLOEXEC) != 0) {
+		fork_pipe[0] = fork_pipe[1] = -1;
+	}
+}
+
+// nothing may change in the files until the child has its copies, it says whether it got all of them
+static void fork_parent(void) {
+	bool pinned = false;
+	if (fork_pipe[0] >= 0) {
+		close(fork_pipe[1]);
+		char copied = 1;  // stays when there is no child, fork() failed or it died
+		while (read(fork_pipe[0], &copied, 1) < 0 && errno == EINTR) {
+		}
+		close(fork_pipe[0]);
+		fork_pipe[0] = fork_pipe[1] = -1;
+		if (!copied) {
+			fork_pin();
+			pinned = true;
+		}
+	}
+	fork_unlock();
+	if (pinned) {
+		pass_through_update();
+	}
+}
+
+// caller holds the arena locks, a child maps some of our files copy on write: whatever is in use now is never
+// punched, cached, recycled or grown in place, and no more fries or store space are handed out
+static void fork_pin(void) {
+	for (int i = 0; i <= n_fry_arenas; i++) {
+		arena* const a = i < n_fry_arenas ? &arena_fries[i] : &arena_bigmaacs;
+		for (node* n = a->head->next; n != NULL; n = n->next) {
+			n->inherited |= n->in_use != FREE;
+		}
+	}
+	fries_inherited = true;
+	min_size_fry = min_size_bigmaac;
+	n_store_files = 0;
+	fprintf(stderr, "BigMaac: a child of pid %d could not copy all files, memory in use now is not reused\n", getpid());
+}
+
+// releases what fork_prepare() took, in the child as well
+static void fork_unlock(void) {
+#ifdef DEBUG
+	pthread_mutex_unlock(&log_lock);
+#endif
+	pthread_mutex_unlock(&trace_lock);
+	pthread_mutex_unlock(&io_lock);
+	pthread_mutex_unlock(&file_pool_lock);
+	for (int i = n_fry_arenas - 1; i >= 0; i--) {
+		pthread_mutex_unlock(&arena_fries[i].lock);
+	}
+	pthread_mutex_unlock(&arena_bigmaacs.lock);
+	pthread_mutex_unlock(&tier_lock);
+	pthread_mutex_unlock(&pass_through_lock);
+	pthread_mutex_unlock(&init_lock);
+}
+
+static void fork_child(void) {
+	persist_dir = NULL;  // the journal is written by the parent
+	if (tier_fd >= 0) {  // the child's mappings are not registered with the userfaultfd of its parent
+		close(tier_fd);
+		tier_fd = -1;
+	}
+	for (int i = 0; i < file_pool_count; i++) {  // the parent hands these out too
+		close(file_pool[i]);
+	}
+	file_pool_count = 0;
+	file_pool_started = false;
+	pthread_cond_init(&file_pool_cond, NULL);  // waited on by threads that are gone
+	pthread_cond_init(&io_cond, NULL);
+	pthread_cond_init(&trace_cond, NULL);
+
+	for (int i = 0; i < extent_cache_count; i++) {  // freed bigmaacs of the parent, it may reuse their files
+		node* const n = extent_cache[i];
+		n->inherited = true;
+		unmap_chunk(n, n->ptr, n->size);
+		arena_free_node(&arena_bigmaacs, n);
+	}
+	extent_cache_count = 0;
+
+	// the fries and the store, a clone per file or the files of the parent
+	int from[MAX_STRIPE_FILES], to[MAX_STRIPE_FILES];
+	int n_files = 0, n_private = 0;
+	bool store_inherited = false;
+	for (size_t i = 0; i < n_stripes; i++) {
+		stripe* const s = &stripes[i];
+		int f = 0;
+		while (f < n_files && from[f] != s->fd) {
+			f++;
+		}
+		if (s->fd >= 0 && f == n_files && n_files < MAX_STRIPE_FILES) {
+			from[f] = s->fd;
+			to[f] = fork_mode == FORK_PRIVATE ? file_copy(s->fd) : -1;
+			n_private += fork_mode == FORK_PRIVATE && to[f] < 0;
+			n_files++;
+		}
+		const int clone = s->fd >= 0 && f < n_files ? to[f] : -1;
+		if (clone < 0) {  // an earlier fork may have left it inherited
+			fries_inherited |= s->ptr < (char*)end_fries;
+			store_inherited |= s->ptr >= (char*)base_bigmaac;
+		}
+		if (s->fd >= 0 && fork_mode == FORK_PRIVATE &&
+		    mmap(s->ptr, s->size, PROT_READ | PROT_WRITE, (clone >= 0 ? map_shared : MAP_PRIVATE | MAP_NORESERVE) | MAP_FIXED, clone >= 0 ? clone : s->fd, s->offset) == MAP_FAILED) {
+			fprintf(stderr, "BigMaac: failed to remap %p after fork() %s\n", s->ptr, strerror(errno));
+		}
+	}
+
+	for (node* n = arena_bigmaacs.head->next; n != NULL; n = n->next) {
+		if (n->in_use != IN_USE || n->inherited) {
+			continue;
+		}
+		n->inherited = fork_mode == FORK_SHARED || n->shared;
+		if (n->maps == 0) {  // a range of the store, the stripes still have the files of the parent
+			if (n->inherited && fork_mode == FORK_PRIVATE && stripes_map(n->ptr, n->size, map_shared) < 0) {
+				fprintf(stderr, "BigMaac: failed to share %p after fork() %s\n", n->ptr, strerror(errno));
+			}
+			n->inherited |= store_inherited;
+			continue;
+		}
+		if (n->inherited) {  // stays in the file of the parent, its mapping keeps it open
+			fd_drop(n->fd);
+			n->fd = -1;
+			continue;
+		}
+		// a file of its own, from the mapping when the parent did not keep the file open
+		const int copy = n->fd >= 0 ? file_copy(n->fd) : memory_copy(n->ptr, n->size);
+		bool remapped;
+		if (copy >= 0) {
+			remapped = mmap(n->ptr, n->size, PROT_READ | PROT_WRITE, map_shared | MAP_FIXED, copy, 0) != MAP_FAILED;
+		} else if (n->fd >= 0) {  // copy on write
+			remapped = mmap(n->ptr, n->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, n->fd, 0) != MAP_FAILED;
+		} else {  // a copy in RAM
+			remapped = memory_copy_anonymous(n->ptr, n->size);
+		}
+		if (!remapped) {
+			fprintf(stderr, "BigMaac: failed to remap %p after fork() %s\n", n->ptr, strerror(errno));
+		}
+		__atomic_fetch_sub(&active_mmaps, n->maps - 1, __ATOMIC_RELAXED);  // one mapping now
+		n->maps = 1;
+		n_private += !remapped || (copy < 0 && n->fd >= 0);
+		n->inherited = copy < 0;
+		fd_drop(n->fd);
+		n->fd = copy < 0 ? -1 : fd_keep(copy);
+	}
+
+	for (size_t i = 0; i < n_stripes; i++) {
+		int f = 0;
+		while (f < n_files && from[f] != stripes[i].fd) {
+			f++;
+		}
+		stripes[i].fd = f < n_files ? to[f] : -1;
+	}
+	for (int f = 0; f < n_files; f++) {
+		close(from[f]);
+	}
+	if (fries_inherited) {  // fries are placed as bigmaacs from now on, only small enough ones go to the system
+		min_size_fry = min_size_bigmaac;
+	}
+	if (store_inherited) {
+		n_store_files = 0;
+	}
+	if (n_private > 0) {
+		fprintf(stderr, "BigMaac: pid %d could not copy %d files, it sees writes of its parent to pages it did not write itself\n", getpid(), n_private);
+	}
+	if (fork_pipe[1] >= 0) {
+		const char copied = n_private == 0;
+		if (write(fork_pipe[1], &copied, 1) != 1) {
+			fprintf(stderr, "BigMaac: failed to tell the parent about the copies %s\n", strerror(errno));
+		}
+		close(fork_pipe[0]);
+		close(fork_pipe[1]);
+		fork_pipe[0] = fork_pipe[1] = -1;
+	}
+
+	fork_unlock();
+	fork_restart();
+}
+
+// start the helper threads again in a child, fork() only copies the calling thread
+static void fork_restart(void) {
+	pass_through_update();
+	if (stats_interval > 0 && !thread_start(stats_worker)) {
+		fprintf(stderr, "BigMaac: failed to start the stats thread\n");
+	}
+	if (io_engine == IO_ENGINE_URING && !thread_start(io_worker)) {
+		fprintf(stderr, "BigMaac: failed to start the I/O thread\n");
+		io_engine = IO_ENGINE_SYNC;
+	}
+	if (rss_limit > 0 && !thread_start(rss_worker)) {
+		fprintf(stderr, "BigMaac: failed to start the rss limit thread\n");
+	}
+	if (adaptive && !thread_start(adaptive_worker)) {
+		fprintf(stderr, "BigMaac: failed to start the adaptive thresholds thread\n");
+		adaptive = false;
+	}
+	if (trace_fd >= 0) {  // events still in the rings are written out by the parent
+		close(trace_fd);
+		for (trace_ring* r = trace_rings; r != NULL; r = r->next) {
+			r->tail = r->head;
+			r->dropped = 0;
+			r->owned = r == thread_trace_ring;
+		}
+		char path[4096];
+		snprintf(path, sizeof(path), "%s.%d", trace_prefix, getpid());
+		trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (trace_fd < 0 || write(trace_fd, TRACE_MAGIC, strlen(TRACE_MAGIC)) < 0) {
+			fprintf(stderr, "BigMaac: cannot open trace file %s %s\n", path, strerror(errno));
+			if (trace_fd >= 0) {
+				close(trace_fd);
+			}
+			trace_fd = -1;
+			return;
+		}
+		trace_write_maps();
+		if (!thread_start(trace_worker)) {
+			fprintf(stderr, "BigMaac: failed to start the trace thread\n");
+		}
+	}
+}
+
+// a copy of a backing file made by its file system, sharing its blocks until either side writes them, or -1
+static int file_clone(const int fd) {
+#if defined(FICLONE)
+	struct stat st;
+	if (backing == BACKING_MEMFD || fstat(fd, &st) != 0) {
+		return -1;
+	}
+	for (int i = 0; i < n_templates; i++) {
+		swap_template* const t = &templates[i];
+		if (t->dev != st.st_dev || t->no_clone) {
+			continue;
+		}
+		const int clone = tmpfile_open_at(t);
+		if (clone >= 0 && ioctl(clone, FICLONE, fd) == 0) {
+			return clone;
+		}
+		if (errno == EOPNOTSUPP || errno == EINVAL || errno == EXDEV || errno == ENOTTY) {
+			t->no_clone = true;
+		}
+		if (clone >= 0) {
+			close(clone);
+		}
+		return -1;
+	}
+#endif
+	return -1;
+}
+
+// the first stripe ending behind ptr, n_stripes if there is none
+static size_t stripe_find(char* const ptr) {
+	size_t lo = 0, hi = n_stripes;
+	while (lo < hi) {
+		const size_t mid = (lo + hi) / 2;
+		if (stripes[mid].ptr + stripes[mid].size <= ptr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// the file under a bigmaac with the offset of n->ptr in it, -1 for an import, a private copy of a file of
+// the parent or a range of the store spread over stripes, the lock of the bigmaac arena is held
+static int chunk_file(const node* const n, off_t* const offset) {
+	*offset = 0;
+	if (n->maps > 0) {
+		return n->fd;
+	}
+	const size_t i = stripe_find(n->ptr);
+	if (i < n_stripes && stripes[i].ptr <= n->ptr && n->ptr + n->size <= stripes[i].ptr + stripes[i].size) {
+		*offset = stripes[i].offset + (n->ptr - stripes[i].ptr);
+		return stripes[i].fd;
+	}
+	return -1;
+}
+
+// a copy of a backing file for a forked child, a clone where the file system can, -1 if there is no room for it
+static int file_copy(const int fd) {
+	const int clone = file_clone(fd);
+	struct stat st;
+	if (clone >= 0 || fstat(fd, &st) != 0) {
+		return clone;
+	}
+	const int copy = tmpfile_open();
+	if (copy < 0) {
+		return -1;
+	}
+	bool ok = ftruncate(copy, st.st_size) == 0;
+	for (off_t next = 0; ok && next < st.st_size;) {  // only the data, holes stay holes
+		off_t start = lseek(fd, next, SEEK_DATA);
+		if (start < 0 && errno == ENXIO) {
+			break;
+		}
+		start = start < 0 ? next : start;  // SEEK_DATA is not supported, copy all of it
+		off_t end = lseek(fd, start, SEEK_HOLE);
+		end = end <= start ? st.st_size : end;
+		ok = range_copy(fd, copy, start, end - start);
+		next = end;
+	}
+	if (!ok) {
+		fprintf(stderr, "BigMaac: failed to copy a file after fork() %s\n", strerror(errno));
+		close(copy);
+		return -1;
+	}
+	return copy;
+}
+
+static bool range_copy(const int from, const int to, off_t offset, size_t length) {
+	while (length > 0) {
+		loff_t in = offset, out = offset;
+		const ssize_t r = copy_file_range(from, &in, to, &out, length, 0);
+		if (r <= 0) {  // not across these file systems, through a buffer then
+			break;
+		}
+		offset += r;
+		length -= r;
+	}
+	const size_t size_buffer = 1 << 20;
+	char* const buffer = length > 0 ? (char*)meta_map(size_buffer) : NULL;
+	if (length > 0 && buffer == NULL) {
+		return false;
+	}
+	while (length > 0) {
+		const ssize_t r = pread(from, buffer, length < size_buffer ? length : size_buffer, offset);
+		if (r <= 0 || pwrite(to, buffer, r, offset) != r) {
+			break;
+		}
+		offset += r;
+		length -= r;
+	}
+	if (buffer != NULL) {
+		meta_unmap(buffer, size_buffer);
+	}
+	return length == 0;
+}
+
+// a new file holding what is mapped at [ptr, ptr + size), for a bigmaac whose file was not kept open
+static int memory_copy(char* const ptr, const size_t size) {
+	const int copy = tmpfile_open();
+	if (copy < 0) {
+		return -1;
+	}
+	size_t done = 0;
+	if (ftruncate(copy, size) == 0) {
+		while (done < size) {
+			const ssize_t r = pwrite(copy, ptr + done, size - done, done);
+			if (r <= 0) {
+				break;
+			}
+			done += r;
+		}
+	}
+	if (done < size) {
+		close(copy);
+		return -1;
+	}
+	return copy;
+}
+
+// the last resort for a bigmaac without a file, a private copy in RAM moved over it
+static bool memory_copy_anonymous(char* const ptr, const size_t size) {
+	char* const copy = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+	if (copy == MAP_FAILED) {
+		return false;
+	}
+	memcpy(copy, ptr, size);
+	return mremap(copy, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, ptr) != MAP_FAILED;
+}
+
+// map [ptr, ptr + size) of the fries or the store from the files of its stripes again, -1 if one is not ours
+static int stripes_map(char* const ptr, const size_t size, const int flags) {
+	for (size_t i = stripe_find(ptr); i < n_stripes && stripes[i].ptr < ptr + size; i++) {
+		const stripe* const s = &stripes[i];
+		char* const start = s->ptr > ptr ? s->ptr : ptr;
+		char* const end = s->ptr + s->size < ptr + size ? s->ptr + s->size : ptr + size;
+		if (s->fd < 0 || mmap(start, end - start, PROT_READ | PROT_WRITE, flags | MAP_FIXED, s->fd, s->offset + (start - s->ptr)) == MAP_FAILED) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// BigMaac persistence
+// With BIGMAAC_PERSIST the fries and the store live in named files in that directory. At exit, and on
+// bigmaac_checkpoint(), the in use chunks are written to a journal there. The next process with the same
+// BIGMAAC_PERSIST reserves the arena at the same address, maps the same files and takes the chunks of the
+// journal out of its heaps, so the data and the pointers in it are back without rebuilding anything. The
+// journal stays until the next one replaces it. Chunks it lists are KEPT when they are freed or moved by
+// realloc: not punched, cached or reused until a new journal no longer lists them, so that a process that
+// does not get to exit comes back as of its last checkpoint, or as it was restored.
+
+// read and check the journal of the process before, false when there is none to restore
+static bool persist_load(void) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/journal", persist_dir);
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	persist_header* h = NULL;
+	size_t size = 0;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(persist_header) && (h = (persist_header*)meta_map(st.st_size)) != NULL) {
+		size = st.st_size;
+		for (size_t done = 0; done < size;) {
+			const ssize_t r = read(fd, (char*)h + done, size - done);
+			if (r <= 0) {
+				size = 0;
+				break;
+			}
+			done += r;
+		}
+	}
+	close(fd);
+
+	bool ok = h != NULL && size > 0 && memcmp(h->magic, PERSIST_MAGIC, sizeof(h->magic)) == 0 && h->page_size == page_size &&
+	          h->bigmaac_multiple == bigmaac_multiple && h->n_fry_arenas >= 1 && h->n_fry_arenas <= MAX_FRY_ARENAS && h->n_store_files >= 1 &&
+	          h->n_store_files <= MAX_STORE_FILES && h->base % bigmaac_multiple == 0 && h->n_chunks == (size - sizeof(persist_header)) / sizeof(persist_chunk) &&
+	          size == sizeof(persist_header) + h->n_chunks * sizeof(persist_chunk);
+	// the chunks have to be in address order and each inside of one arena
+	const uint64_t end_fries = ok ? h->base + h->size_fries : 0;
+	const uint64_t size_sub = ok ? h->size_fries / h->n_fry_arenas / page_size * page_size : 0;
+	const persist_chunk* const chunks = (const persist_chunk*)(h + 1);
+	uint64_t end = ok ? h->base : 0;
+	for (uint64_t i = 0; ok && i < h->n_chunks; i++) {
+		const persist_chunk* const c = &chunks[i];
+		uint64_t limit = end_fries + h->size_bigmaac;
+		if (c->ptr < end_fries) {
+			const uint64_t sub = size_sub == 0 ? 0 : (c->ptr - h->base) / size_sub;
+			limit = size_sub == 0 || sub >= (uint64_t)h->n_fry_arenas - 1 ? end_fries : h->base + (sub + 1) * size_sub;
+		}
+		ok = c->ptr >= end && c->ptr < limit && c->size > 0 && c->size <= limit - c->ptr;
+		end = c->ptr + c->size;
+	}
+	if (!ok) {
+		fprintf(stderr, "BigMaac: journal %s does not fit, starting empty\n", path);
+		if (h != NULL) {
+			meta_unmap(h, st.st_size);
+		}
+		return false;
+	}
+	persist_journal = h;
+	persist_journal_size = size;
+	return true;
+}
+
+// the next named file, empty unless there is a journal to restore it with
+static int persist_open(void) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/bigmaac.%d", persist_dir, persist_files++);
+	const int flags = persist_journal != NULL ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC;
+	const int fd = open(path, flags | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		fprintf(stderr, "BigMaac: cannot open %s %s\n", path, strerror(errno));
+	}
+	return fd;
+}
+
+// take the chunks of the journal out of the fresh heaps, only called while loading
+static int persist_restore(void) {
+	const persist_chunk* const chunks = (const persist_chunk*)(persist_journal + 1);
+	arena* a = NULL;
+	node* f = NULL;  // the free node the next chunk is cut from
+	for (uint64_t i = 0; i < persist_journal->n_chunks; i++) {
+		char* const ptr = (char*)(uintptr_t)chunks[i].ptr;
+		const size_t size = chunks[i].size;
+		if (arena_of(ptr) != a) {
+			a = arena_of(ptr);
+			f = a->head->next;
+		}
+		while (f != NULL && (f->in_use != FREE || f->ptr + f->size <= ptr)) {
+			f = f->next;
+		}
+		if (f == NULL || f->ptr > ptr || f->ptr + f->size < ptr + size) {
+			return -1;
+		}
+
+		// like heap_pop_aligned(), the space cut off in front and behind is freed again
+		heap_remove(&a->heap, f);
+		f->in_use = IN_USE;
+		node* n = f;
+		if (ptr > n->ptr) {
+			node* const body = heap_split_node(a->head, n, ptr - n->ptr);
+			if (body == NULL) {
+				return -1;
+			}
+			heap_free_node(a->head, n);
+			n = body;
+		}
+		if (n->size > size) {
+			node* const tail = heap_split_node(a->head, n, size);
+			if (tail == NULL) {
+				return -1;
+			}
+			heap_free_node(a->head, tail);
+		}
+		n->maps = 0;
+		n->fd = -1;
+		n->shared = false;
+		n->inherited = false;
+		n->exported = false;
+		n->journaled = true;
+		a->used += size;
+		*index_slot(ptr) = n;
+		rss_born(n);
+		if (a->fresh < ptr + size) {
+			a->fresh = ptr + size;
+		}
+		count_alloc(a == &arena_bigmaacs ? &counters_bigmaacs : &counters_fries, size, size, ptr);
+		f = n->next;
+	}
+	return 0;
+}
+
+// write the in use chunks to the journal, with sync the files are written back first
+static int persist_write(const bool sync) {
+	if (persist_dir == NULL) {
+		return 0;
+	}
+	pthread_mutex_lock(&persist_lock);
+	for (size_t i = 0; sync && i < n_stripes; i++) {
+		if (stripes[i].fd >= 0 && fdatasync(stripes[i].fd) != 0) {
+			fprintf(stderr, "BigMaac: failed to sync %s %s\n", persist_dir, strerror(errno));
+			pthread_mutex_unlock(&persist_lock);
+			return -1;
+		}
+	}
+
+	arena* arenas[MAX_FRY_ARENAS + 1];
+	int n_arenas = 0;
+	for (int i = 0; i < n_fry_arenas; i++) {
+		arenas[n_arenas++] = &arena_fries[i];
+	}
+	arenas[n_arenas++] = &arena_bigmaacs;
+	pthread_mutex_lock(&tier_lock);
+	arena_lock(&arena_bigmaacs);
+	for (int i = 0; i < n_fry_arenas; i++) {
+		arena_lock(&arena_fries[i]);
+	}
+	tier_restore();  // the next process finds only what is in the files
+
+	uint64_t n_chunks = 0;
+	size_t n_kept = 0;
+	for (int i = 0; i < n_arenas; i++) {
+		for (const node* n = arenas[i]->head->next; n != NULL; n = n->next) {
+			n_chunks += n->in_use == IN_USE && n->maps == 0 && !n->inherited;  // not imports or files of a parent
+			n_kept += n->in_use == KEPT;
+		}
+	}
+	const size_t size = sizeof(persist_header) + n_chunks * sizeof(persist_chunk);
+	persist_header* const h = (persist_header*)meta_map(size);
+	const size_t size_kept = SIZE_TO_MULTIPLE(sizeof(char*) * (n_kept + 1), page_size);
+	char** const kept = h == NULL ? NULL : (char**)meta_map(size_kept);  // freed once the new journal is down
+	if (h != NULL && kept == NULL) {
+		meta_unmap(h, size);
+	}
+	if (kept != NULL) {
+		*h = (persist_header){.base = (uintptr_t)base_fries,
+		                      .size_fries = size_fries,
+		                      .size_bigmaac = size_bigmaac,
+		                      .bigmaac_multiple = bigmaac_multiple,
+		                      .page_size = page_size,
+		                      .n_fry_arenas = n_fry_arenas,
+		                      .n_store_files = n_store_files,
+		                      .root = (uintptr_t)persist_root,
+		                      .n_chunks = n_chunks};
+		memcpy(h->magic, PERSIST_MAGIC, sizeof(h->magic));
+		persist_chunk* c = (persist_chunk*)(h + 1);
+		size_t k = 0;
+		for (int i = 0; i < n_arenas; i++) {
+			for (node* n = arenas[i]->head->next; n != NULL; n = n->next) {
+				if (n->in_use == IN_USE && n->maps == 0 && !n->inherited) {
+					*c++ = (persist_chunk){.ptr = (uintptr_t)n->ptr, .size = n->size};
+					n->journaled = true;
+				} else if (n->in_use == KEPT) {
+					kept[k++] = n->ptr;
+				}
+			}
+		}
+	}
+	for (int i = n_fry_arenas - 1; i >= 0; i--) {
+		pthread_mutex_unlock(&arena_fries[i].lock);
+	}
+	pthread_mutex_unlock(&arena_bigmaacs.lock);
+	pthread_mutex_unlock(&tier_lock);
+	if (kept == NULL) {
+		pthread_mutex_unlock(&persist_lock);
+		return -1;
+	}
+
+	// written next to it and renamed over it, a journal is either the old one or the new one
+	char path[4096], next[4096];
+	snprintf(path, sizeof(path), "%s/journal", persist_dir);
+	snprintf(next, sizeof(next), "%s/journal.next", persist_dir);
+	const int fd = open(next, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	size_t done = 0;
+	while (fd >= 0 && done < size) {
+		const ssize_t r = write(fd, (char*)h + done, size - done);
+		if (r <= 0) {
+			break;
+		}
+		done += r;
+	}
+	const bool written = fd >= 0 && done == size && fdatasync(fd) == 0;
+	if (fd >= 0) {
+		close(fd);
+	}
+	meta_unmap(h, size);
+	const int ret = written && rename(next, path) == 0 ? 0 : -1;
+	if (ret < 0) {
+		fprintf(stderr, "BigMaac: failed to write the journal %s %s\n", path, strerror(errno));
+		unlink(next);
+	} else {
+		const int dir = open(persist_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);  // make the rename itself durable
+		if (dir >= 0) {
+			fsync(dir);
+			close(dir);
+		}
+	}
+	for (size_t i = 0; ret == 0 && i < n_kept; i++) {  // the journal on disk no longer lists them
+		arena* const a = arena_of(kept[i]);
+		arena_lock(a);
+		node* const n = heap_find_node(kept[i]);
+		n->in_use = IN_USE;
+		n->journaled = false;
+		pthread_mutex_unlock(&a->lock);
+		if (free_chunk(kept[i]) == 0) {
+			fprintf(stderr, "BigMaac: is missing memory address it should have\n");
+		}
+	}
+	meta_unmap(kept, size_kept);
+	pthread_mutex_unlock(&persist_lock);
+	return ret;
+}
+
+static void persist_finish(void) {
+	persist_write(true);  // the data before the journal, or a crash leaves a journal over stale files
+}
+
+// called before a chunk is freed, true when the journal lists it and it is KEPT as it is instead
+static bool persist_keep(void* const ptr) {
+	if (persist_dir == NULL) {
+		return false;
+	}
+	arena* const a = arena_of(ptr);
+	arena_lock(a);
+	node* const n = heap_find_node(ptr);
+	const bool keep = n != NULL && n->in_use == IN_USE && n->journaled;
+	if (keep) {
+		n->in_use = KEPT;
+	}
+	pthread_mutex_unlock(&a->lock);
+	return keep;
+}
+
+// BigMaac access hints
+
+static int advice_parse(const char* const s) {
+	const char* const names[] = {"normal", "sequential", "random", "willneed", "dontneed", "cold", "pageout", "writeback"};
+	for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strcmp(s, names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int advise_range(void* const ptr, const size_t len, const int advice) {
+	switch (advice) {
+		case BIGMAAC_NORMAL:
+			return madvise(ptr, len, MADV_NORMAL);
+		case BIGMAAC_SEQUENTIAL:
+			return madvise(ptr, len, MADV_SEQUENTIAL);
+		case BIGMAAC_RANDOM:
+			return madvise(ptr, len, MADV_RANDOM);
+		case BIGMAAC_WILLNEED:
+			return madvise(ptr, len, MADV_WILLNEED);
+		case BIGMAAC_DONTNEED:  // the mappings are shared, so the data stays in the file
+			return madvise(ptr, len, MADV_DONTNEED);
+#if defined(MADV_COLD)
+		case BIGMAAC_COLD:
+			return madvise(ptr, len, MADV_COLD);
+#endif
+#if defined(MADV_PAGEOUT)
+		case BIGMAAC_PAGEOUT:
+			return madvise(ptr, len, MADV_PAGEOUT);
+#endif
+		case BIGMAAC_WRITEBACK:
+			return msync(ptr, len, MS_SYNC);
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+}
+
+// the posix_fadvise() that goes with a hint for the file under the range, madvise() only sets up the mapping
+// and the readahead state of a file is kept per open file, -1 for hints that only concern the mapping
+static int file_advice(const int advice) {
+	switch (advice) {
+		case BIGMAAC_NORMAL:
+			return POSIX_FADV_NORMAL;
+		case BIGMAAC_SEQUENTIAL:
+			return POSIX_FADV_SEQUENTIAL;
+		case BIGMAAC_RANDOM:
+			return POSIX_FADV_RANDOM;
+		case BIGMAAC_WILLNEED:
+			return POSIX_FADV_WILLNEED;
+		case BIGMAAC_DONTNEED:  // after madvise() dropped the mapping, written back and out of the page cache
+			return POSIX_FADV_DONTNEED;
+		default:
+			return -1;
+	}
+}
+
+// BigMaac I/O engine
+// Without it a hint runs in the calling thread, WILLNEED reads the range in before returning and the
+// faults in it are served one at a time. With BIGMAAC_IO_ENGINE=uring hinted WILLNEED and WRITEBACK
+// ranges are queued for a helper thread instead. It splits them into IO_PIECE_SIZE requests on an
+// io_uring, madvise() for read ahead and sync_file_range() on the file under the range for writeback,
+// which the kernel runs concurrently with up to BIGMAAC_IO_DEPTH in flight, so the device sees a deep
+// queue. Writeback of a range without a file of its own (kept open) stays a MS_SYNC in the helper thread.
+// Hints are dropped to the calling thread when the queue is full and the helper runs plain madvise() and
+// msync() when the kernel refuses io_uring.
+
+static bool io_queue_put(const io_request r) {
+	pthread_mutex_lock(&io_lock);
+	const bool queued = io_queue_count < MAX_IO_QUEUE;
+	if (queued) {
+		io_queue[(io_queue_head + io_queue_count++) % MAX_IO_QUEUE] = r;
+		pthread_cond_signal(&io_cond);
+	}
+	pthread_mutex_unlock(&io_lock);
+	return queued;
+}
+
+#if defined(BIGMAAC_IO_URING)
+static bool io_ring_setup(io_ring* const ring, const unsigned entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0) {
+		return false;
+	}
+	const size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	const size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	char* const sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	char* const cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		close(ring->fd);
+		return false;
+	}
+	__atomic_fetch_add(&active_mmaps, 3, __ATOMIC_RELAXED);
+	ring->entries = params.sq_entries;
+	ring->in_flight = 0;
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return true;
+}
+
+// submit what is queued, wait for at least min_complete requests and reap every finished one
+static void io_ring_submit(io_ring* const ring, const unsigned min_complete) {
+	syscall(__NR_io_uring_enter, ring->fd, ring->entries, min_complete, min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	unsigned head = *ring->cq_head;
+	for (; head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE); head++) {
+		const struct io_uring_cqe* const cqe = &ring->cqes[head & *ring->cq_mask];
+		if (cqe->res < 0) {
+			log_bm("io_uring hint %p failed %s\n", (void*)cqe->user_data, strerror(-cqe->res));
+		}
+		ring->in_flight--;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// read ahead of r.ptr or, with r.fd, writeback of the file under it, which is then waited for so r.fd can be closed
+static void io_ring_queue(io_ring* const ring, const io_request r) {
+	for (size_t offset = 0; offset < r.len; offset += IO_PIECE_SIZE) {
+		if (ring->in_flight == ring->entries) {
+			io_ring_submit(ring, 1);
+		}
+		const unsigned tail = *ring->sq_tail;
+		const unsigned index = tail & *ring->sq_mask;
+		struct io_uring_sqe* const sqe = &ring->sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->len = r.len - offset < IO_PIECE_SIZE ? r.len - offset : IO_PIECE_SIZE;
+		if (r.fd >= 0) {
+			sqe->opcode = IORING_OP_SYNC_FILE_RANGE;
+			sqe->fd = r.fd;
+			sqe->off = r.offset + offset;
+			sqe->sync_range_flags = SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER;
+		} else {
+			sqe->opcode = IORING_OP_MADVISE;
+			sqe->fd = -1;
+			sqe->addr = (uintptr_t)(r.ptr + offset);
+			sqe->fadvise_advice = MADV_WILLNEED;
+		}
+		sqe->user_data = (uintptr_t)(r.ptr + offset);
+		ring->sq_array[index] = index;
+		__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+		ring->in_flight++;
+	}
+	io_ring_submit(ring, 0);
+	while (r.fd >= 0 && ring->in_flight > 0) {  // the kernel looks the file up when a request runs, not when it is queued
+		io_ring_submit(ring, 1);
+	}
+}
+#endif
+
+static void* io_worker(void* const arg) {
+#if defined(BIGMAAC_IO_URING)
+	io_ring ring;
+	const bool uring = io_ring_setup(&ring, io_depth);
+	if (!uring) {
+		fprintf(stderr, "BigMaac: io_uring not available, hints run in the I/O thread %s\n", strerror(errno));
+	}
+#endif
+	for (;;) {
+		pthread_mutex_lock(&io_lock);
+#if defined(BIGMAAC_IO_URING)
+		while (io_queue_count == 0 && uring && ring.in_flight > 0) {  // nothing new, wait for the device instead
+			pthread_mutex_unlock(&io_lock);
+			io_ring_submit(&ring, 1);
+			pthread_mutex_lock(&io_lock);
+		}
+#endif
+		while (io_queue_count == 0) {
+			pthread_cond_wait(&io_cond, &io_lock);
+		}
+		const io_request r = io_queue[io_queue_head];
+		io_queue_head = (io_queue_head + 1) % MAX_IO_QUEUE;
+		io_queue_count--;
+		pthread_mutex_unlock(&io_lock);
+
+#if defined(BIGMAAC_IO_URING)
+		if (uring && (r.advice == BIGMAAC_WILLNEED || r.fd >= 0)) {
+			io_ring_queue(&ring, r);
+			if (r.fd >= 0) {
+				close(r.fd);
+			}
+			continue;
+		}
+#endif
+		advise_range(r.ptr, r.len, r.advice);  // the range may be gone by now, which only makes the call fail
+		if (r.fd >= 0) {
+			close(r.fd);
+		}
+	}
+	return NULL;
+}
+
+// BigMaac statistics
+// Allocations and frees are counted per kind of chunk with relaxed atomics, everything else is read off
+// the arenas under their locks when asked for. BIGMAAC_STATS_INTERVAL runs a thread dumping the numbers.
+
+FORCE_INLINE void* count_alloc(counters* const c, const size_t requested, const size_t size, void* const ptr) {
+	__atomic_fetch_add(&c->allocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->bytes_requested, requested, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->bytes_allocated, size, __ATOMIC_RELAXED);
+	if (adaptive) {
+		__atomic_fetch_add(&c->size_classes[64 - __builtin_clzll(size)], 1, __ATOMIC_RELAXED);
+	}
+	return ptr;
+}
+
+FORCE_INLINE void count_free(void* const ptr) { __atomic_fetch_add(ptr < end_fries ? &counters_fries.frees : &counters_bigmaacs.frees, 1, __ATOMIC_RELAXED); }
+
+// add the numbers of one arena, pages of in use chunks are checked with mincore() for being in RAM. That
+// is done on a copy of the runs of in use chunks after unlocking, mincore() can take a while on big chunks.
+static void arena_stats(arena* const a, struct bigmaac_arena_stats* const s) {
+	arena_lock(a);
+	s->bytes_reserved += a->end - a->base;
+	s->bytes_used += a->used;
+	s->free_extents += a->heap.used;
+	const node* const largest = heap_largest(&a->heap);
+	if (largest != NULL && largest->size > s->largest_free_extent) {
+		s->largest_free_extent = largest->size;
+	}
+	s->lock_wait_ns += a->lock_wait_ns;
+	const size_t used = a->used;
+
+	size_t n_runs = 0;
+	bool in_run = false;
+	for (const node* n = a->head->next; n != NULL; n = n->next) {
+		n_runs += n->in_use != FREE && !in_run;
+		in_run = n->in_use != FREE;
+	}
+	char** const runs = n_runs == 0 ? NULL : (char**)meta_map(n_runs * 2 * sizeof(char*));  // start and end of each
+	size_t count = 0;
+	for (const node* n = a->head->next; runs != NULL && n != NULL;) {
+		if (n->in_use == FREE) {
+			n = n->next;
+			continue;
+		}
+		runs[2 * count] = n->ptr;  // take neighbouring chunks that are not free in one go, cached or kept ones too
+		while (n != NULL && n->in_use != FREE) {
+			n = n->next;
+		}
+		runs[2 * count + 1] = n == NULL ? a->end : n->ptr;
+		count++;
+	}
+	pthread_mutex_unlock(&a->lock);
+
+	// chunks freed since are PROT_NONE or punched, and count as not resident
+	size_t resident = 0;
+	for (size_t i = 0; i < count; i++) {
+		const size_t run_resident = resident_bytes(runs[2 * i], runs[2 * i + 1]);
+		const size_t run_size = runs[2 * i + 1] - runs[2 * i];
+		resident += run_resident < run_size ? run_resident : run_size;
+	}
+	if (runs != NULL) {
+		meta_unmap(runs, n_runs * 2 * sizeof(char*));
+	}
+
+	s->bytes_resident += resident;
+	s->bytes_swapped += used > resident ? used - resident : 0;
+}
+
+int bigmaac_stats(struct bigmaac_stats* stats) {
+	if (stats == NULL || __atomic_load_n(&load_state, __ATOMIC_ACQUIRE) != LOADED) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(stats, 0, sizeof(*stats));
+
+	counters* const c[2] = {&counters_fries, &counters_bigmaacs};
+	struct bigmaac_arena_stats* const s[2] = {&stats->fries, &stats->bigmaacs};
+	for (int i = 0; i < 2; i++) {
+		s[i]->allocs = __atomic_load_n(&c[i]->allocs, __ATOMIC_RELAXED);
+		s[i]->frees = __atomic_load_n(&c[i]->frees, __ATOMIC_RELAXED);
+		s[i]->bytes_requested = __atomic_load_n(&c[i]->bytes_requested, __ATOMIC_RELAXED);
+		s[i]->bytes_allocated = __atomic_load_n(&c[i]->bytes_allocated, __ATOMIC_RELAXED);
+	}
+	for (int i = 0; i < n_fry_arenas; i++) {
+		arena_stats(&arena_fries[i], &stats->fries);
+	}
+	arena_stats(&arena_bigmaacs, &stats->bigmaacs);
+
+	stats->active_mmaps = __atomic_load_n(&active_mmaps, __ATOMIC_RELAXED);
+	stats->process_mmaps = -1;
+	FILE* const maps = fopen("/proc/self/maps", "r");
+	if (maps != NULL) {
+		stats->process_mmaps = 0;
+		for (int ch; (ch = fgetc(maps)) != EOF;) {
+			stats->process_mmaps += ch == '\n';
+		}
+		fclose(maps);
+	}
+	stats->realloc_bytes_copied = __atomic_load_n(&realloc_bytes_copied, __ATOMIC_RELAXED);
+	stats->compressed_bytes = __atomic_load_n(&tier_bytes, __ATOMIC_RELAXED);
+	stats->compressed_stored = __atomic_load_n(&tier_stored, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static void* stats_worker(void* const arg) {
+	const double mb = 1024 * 1024;
+	for (;;) {
+		sleep(stats_interval);
+		struct bigmaac_stats stats;
+		if (bigmaac_stats(&stats) != 0) {
+			continue;
+		}
+		FILE* const out = stats_file == NULL ? stderr : fopen(stats_file, "a");
+		if (out == NULL) {
+			fprintf(stderr, "BigMaac: cannot open stats file %s %s\n", stats_file, strerror(errno));
+			continue;
+		}
+		const char* const names[2] = {"fries", "bigmaacs"};
+		const struct bigmaac_arena_stats* const s[2] = {&stats.fries, &stats.bigmaacs};
+		for (int i = 0; i < 2; i++) {
+			fprintf(out,
+			        "BigMaac stats %d: %s allocs %llu frees %llu requested %.2f MB allocated %.2f MB used %.2f / %.2f MB resident %.2f MB swapped %.2f MB free "
+			        "extents %zu largest %.2f MB lock wait %.3f ms\n",
+			        getpid(), names[i], s[i]->allocs, s[i]->frees, s[i]->bytes_requested / mb, s[i]->bytes_allocated / mb, s[i]->bytes_used / mb,
+			        s[i]->bytes_reserved / mb, s[i]->bytes_resident / mb, s[i]->bytes_swapped / mb, s[i]->free_extents, s[i]->largest_free_extent / mb,
+			        s[i]->lock_wait_ns / 1e6);
+		}
+		fprintf(out, "BigMaac stats %d: mmaps %d of %d in the process realloc copied %.2f MB compressed %.2f MB in %.2f MB\n", getpid(), stats.active_mmaps,
+		        stats.process_mmaps, stats.realloc_bytes_copied / mb, stats.compressed_bytes / mb, stats.compressed_stored / mb);
+		if (out != stderr) {
+			fclose(out);
+		}
+	}
+	return NULL;
+}
+
+// start a detached helper thread, signals stay with the application threads
+static bool thread_start(void* (*const worker)(void*)) {
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	pthread_t thread;
+	const bool started = pthread_create(&thread, NULL, worker, NULL) == 0;
+	if (started) {
+		pthread_detach(thread);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return started;
+}
+
+// bytes of the pages overlapping [start, end) that are in RAM, from mincore()
+static size_t resident_bytes(char* const start, char* const end) {
+	unsigned char vec[4096];
+	const size_t step = sizeof(vec) * page_size;
+	size_t resident = 0;
+	for (char* p = start - (uintptr_t)start % page_size; p < end; p += step) {
+		const size_t len = (size_t)(end - p) < step ? (size_t)(end - p) : step;
+		if (mincore(p, len, (void*)vec) != 0) {
+			break;
+		}
+		for (size_t i = 0; i < (len + page_size - 1) / page_size; i++) {
+			resident += (vec[i] & 1) * page_size;
+		}
+	}
+	return resident;
+}
+
+// BigMaac rss limit
+// With BIGMAAC_RSS_LIMIT set a helper thread checks every BIGMAAC_RSS_INTERVAL ms what the process is
+// charged for, memory.current of its cgroup or else its resident set. Above the limit it writes back and
+// pages out in use chunks, least recently allocated first, until RSS_LOW_WATERMARK percent of the limit
+// is reached, so the kernel does not have to reclaim (or the OOM killer step in) under pressure. With a
+// compressed tier bigmaac pages try that first.
+
+FORCE_INLINE void rss_born(node* const n) { n->born = rss_limit > 0 ? __atomic_add_fetch(&rss_clock, 1, __ATOMIC_RELAXED) : 0; }
+
+// find memory.current (cgroup v2) or memory.usage_in_bytes (v1) of the cgroup we run in
+static void rss_find_cgroup(void) {
+	FILE* const f = fopen("/proc/self/cgroup", "r");
+	if (f == NULL) {
+		return;
+	}
+	char line[4096];
+	while (fgets(line, sizeof(line), f) != NULL) {  // hierarchy-ID:controllers:path
+		line[strcspn(line, "\n")] = '\0';
+		char* const controllers = strchr(line, ':');
+		char* const path = controllers == NULL ? NULL : strchr(controllers + 1, ':');
+		if (path == NULL) {
+			continue;
+		}
+		*path = '\0';
+		if (controllers[1] == '\0') {
+			snprintf(rss_usage_file, sizeof(rss_usage_file), "/sys/fs/cgroup%s/memory.current", path + 1);
+		} else if (strstr(controllers + 1, "memory") != NULL) {
+			snprintf(rss_usage_file, sizeof(rss_usage_file), "/sys/fs/cgroup/memory%s/memory.usage_in_bytes", path + 1);
+		} else {
+			continue;
+		}
+		if (access(rss_usage_file, R_OK) == 0) {
+			break;
+		}
+		rss_usage_file[0] = '\0';
+	}
+	fclose(f);
+}
+
+static size_t rss_usage(void) {
+	unsigned long long usage = 0;
+	const bool cgroup = rss_usage_file[0] != '\0';
+	FILE* const f = fopen(cgroup ? rss_usage_file : "/proc/self/statm", "r");
+	if (f == NULL) {
+		return 0;
+	}
+	if (fscanf(f, cgroup ? "%llu" : "%*u %llu", &usage) != 1) {
+		usage = 0;
+	}
+	fclose(f);
+	return cgroup ? usage : usage * page_size;
+}
+
+// append the in use chunks of an arena to victims, neighbouring small ones merged up to RSS_SPAN and large ones split
+static size_t rss_collect(arena* const a, rss_victim* const victims, size_t count) {
+	arena_lock(a);
+	for (node* n = a->head->next; n != NULL && count < MAX_RSS_VICTIMS; n = n->next) {
+		if (n->in_use != IN_USE) {
+			continue;
+		}
+		// inherited chunks and fries may be private copies of a parent's files, or mapped copy on write from one
+		const bool dontneed = !n->inherited && (a == &arena_bigmaacs || !fries_inherited);
+		rss_victim* const last = count > 0 ? &victims[count - 1] : NULL;
+		if (last != NULL && last->ptr + last->size == n->ptr && last->size + n->size <= RSS_SPAN) {
+			last->size += n->size;
+			last->born = n->born > last->born ? n->born : last->born;
+			last->chunk = NULL;
+			last->dontneed = last->dontneed && dontneed;
+			continue;
+		}
+		for (size_t offset = 0; offset < n->size && count < MAX_RSS_VICTIMS; offset += RSS_SPAN) {
+			const size_t size = n->size - offset < RSS_SPAN ? n->size - offset : RSS_SPAN;
+			// the tier only covers bigmaacs, and pages of a file other processes map as well must stay in it
+			const bool tier = a == &arena_bigmaacs && !n->inherited && !n->exported;
+			victims[count++] = (rss_victim){.ptr = n->ptr + offset, .size = size, .born = n->born, .chunk = tier ? n->ptr : NULL, .dontneed = dontneed};
+		}
+	}
+	pthread_mutex_unlock(&a->lock);
+	return count;
+}
+
+static int rss_by_age(const void* a, const void* b) {
+	const unsigned long long x = ((const rss_victim*)a)->born, y = ((const rss_victim*)b)->born;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// write back and page out a victim, returns about how many bytes left RAM. The chunks may have been freed
+// since they were collected, that is harmless: both calls fail on PROT_NONE and only drop clean pages.
+static size_t rss_page_out(const rss_victim* const v) {
+	char* const start = v->ptr - (uintptr_t)v->ptr % page_size;
+	const size_t span = v->ptr + v->size - start;
+	const size_t len = SIZE_TO_MULTIPLE(span, page_size);
+	const size_t resident = resident_bytes(start, start + len);
+	if (resident == 0) {
+		return 0;
+	}
+	msync(start, len, MS_SYNC);  // reclaim from madvise() does not write back dirty file pages itself
+	if (advise_range(start, len, BIGMAAC_PAGEOUT) != 0 && advise_range(start, len, BIGMAAC_COLD) != 0 && v->dontneed) {
+		advise_range(start, len, BIGMAAC_DONTNEED);  // on shared mappings this drops clean pages only
+	}
+	return resident;
+}
+
+static void* rss_worker(void* const arg) {
+	rss_victim* const victims = (rss_victim*)meta_map(sizeof(rss_victim) * MAX_RSS_VICTIMS);
+	if (victims == NULL) {
+		return NULL;
+	}
+	const struct timespec interval = {.tv_sec = rss_interval_ms / 1000, .tv_nsec = (rss_interval_ms % 1000) * 1000000L};
+	for (;;) {
+		nanosleep(&interval, NULL);
+		const size_t usage = rss_usage();
+		if (usage <= rss_limit) {
+			continue;
+		}
+		const size_t target = usage - rss_limit / 100 * RSS_LOW_WATERMARK;
+
+		size_t count = 0;
+		for (int i = 0; i < n_fry_arenas; i++) {
+			count = rss_collect(&arena_fries[i], victims, count);
+		}
+		count = rss_collect(&arena_bigmaacs, victims, count);
+		qsort(victims, count, sizeof(rss_victim), rss_by_age);
+
+		size_t reclaimed = 0;
+		for (size_t i = 0; i < count && reclaimed < target; i++) {
+			reclaimed += tier_evict(&victims[i]);  // what does not compress goes on to the files
+			reclaimed += reclaimed < target ? rss_page_out(&victims[i]) : 0;
+		}
+		log_bm("rss usage %zu limit %zu reclaimed %zu of %zu victims\n", usage, rss_limit, reclaimed, count);
+	}
+	return NULL;
+}
+
+// BigMaac compressed tier
+// With BIGMAAC_COMPRESSED_TIER set the rss limit moves bigmaac pages into RAM first, LZ4 compressed when
+// liblz4 can be loaded and all zero pages for free, and only what does not compress to half a page goes
+// on to the files. The chunk is registered with a userfaultfd. A page is write protected while it is
+// compressed and then punched out of its file, touching it again faults into tier_worker which copies it
+// back. userfaultfd only handles missing pages of shared memory, so this needs BIGMAAC_BACKING=memfd or
+// templates on tmpfs, where what leaves the tier goes to the system swap and not to a disk. The tier does
+// not start on other backing. Every lock order is tier_lock before an arena lock, and nothing faults on a
+// tier page while holding tier_lock.
+
+#if defined(BIGMAAC_TIER)
+// userfaultfd can fill missing pages of every backing file
+static bool tier_backing_shmem(void) {
+	if (backing == BACKING_MEMFD) {
+		return true;
+	}
+	for (int i = 0; i < n_templates; i++) {
+		struct statfs fs;
+		if (statfs(templates[i].dir, &fs) != 0 || fs.f_type != 0x01021994) {  // TMPFS_MAGIC
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool tier_start(void) {
+	if (hugepages != HUGEPAGES_OFF) {
+		fprintf(stderr, "BigMaac: the compressed tier works on small pages only\n");
+		return false;
+	}
+	if (!tier_backing_shmem()) {
+		fprintf(stderr, "BigMaac: BIGMAAC_COMPRESSED_TIER needs BIGMAAC_BACKING=memfd or a template on tmpfs, no compressed tier\n");
+		return false;
+	}
+	tier_fd = syscall(__NR_userfaultfd, O_CLOEXEC);
+	struct uffdio_api api = {.api = UFFD_API, .features = UFFD_FEATURE_MISSING_SHMEM | UFFD_FEATURE_WP_HUGETLBFS_SHMEM};
+	if (tier_fd < 0 || ioctl(tier_fd, UFFDIO_API, &api) != 0) {
+		fprintf(stderr, "BigMaac: no userfaultfd for the compressed tier %s\n", strerror(errno));
+		if (tier_fd >= 0) {
+			close(tier_fd);
+		}
+		tier_fd = -1;
+		return false;
+	}
+
+	const size_t size_slots = SIZE_TO_MULTIPLE(sizeof(tier_page*) * (size_bigmaac / page_size + 1), page_size);
+	void* const slots = mmap(NULL, size_slots, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+	tier_buffer = (char*)meta_map(page_size * 2);
+	if (slots == MAP_FAILED || tier_buffer == NULL) {
+		fprintf(stderr, "BigMaac: failed to map the compressed tier %s\n", strerror(errno));
+		close(tier_fd);
+		tier_fd = -1;
+		return false;
+	}
+	__atomic_fetch_add(&active_mmaps, 1, __ATOMIC_RELAXED);
+	tier_pages = (tier_page**)slots;
+
+	void* const lz4 = dlopen("liblz4.so.1", RTLD_NOW | RTLD_LOCAL);
+	if (lz4 != NULL) {
+		lz4_compress = (int (*)(const char*, char*, int, int))dlsym(lz4, "LZ4_compress_default");
+		lz4_decompress = (int (*)(const char*, char*, int, int))dlsym(lz4, "LZ4_decompress_safe");
+	}
+	if (lz4_compress == NULL || lz4_decompress == NULL) {
+		fprintf(stderr, "BigMaac: liblz4 not found, the compressed tier only takes zero pages\n");
+		lz4_compress = NULL;
+	}
+
+	if (!thread_start(tier_worker)) {
+		fprintf(stderr, "BigMaac: failed to start the compressed tier thread\n");
+		close(tier_fd);
+		tier_fd = -1;
+		return false;
+	}
+	return true;
+}
+
+// take tier_lock before [ptr, ptr + size) gets unmapped, punched or moved and drop its compressed pages,
+// with restore they are copied back in first. Until tier_end() nobody pages anything of it in or out.
+static void tier_begin(char* const ptr, const size_t size, const bool restore) {
+	if (tier_fd < 0) {
+		return;
+	}
+	pthread_mutex_lock(&tier_lock);
+	tier_page** const slots = tier_pages + (ptr - (char*)base_bigmaac) / page_size;
+	for (size_t i = 0; i < size / page_size; i++) {
+		if (slots[i] != NULL && !(restore && tier_fill(ptr + i * page_size))) {
+			tier_bytes -= page_size;
+			tier_stored -= slots[i]->length;
+			if (slots[i] != &tier_zero) {
+				real_free((size_t)slots[i]);
+			}
+			slots[i] = NULL;
+		}
+	}
+}
+
+static void tier_end(void) {
+	if (tier_fd >= 0) {
+		pthread_mutex_unlock(&tier_lock);
+	}
+}
+
+// caller holds tier_lock, chunk is still handed out and covers up to end
+static bool tier_chunk_in_use(char* const chunk, char* const end) {
+	arena_lock(&arena_bigmaacs);
+	const node* const n = heap_find_node(chunk);
+	const bool in_use = n != NULL && n->in_use == IN_USE && n->ptr + n->size >= end;
+	pthread_mutex_unlock(&arena_bigmaacs.lock);
+	return in_use;
+}
+
+static int tier_protect(char* const ptr, const size_t len, const bool protect) {
+	struct uffdio_writeprotect wp = {.range = {.start = (uintptr_t)ptr, .len = len}, .mode = protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0};
+	return ioctl(tier_fd, UFFDIO_WRITEPROTECT, &wp);
+}
+
+// caller holds tier_lock, copy a missing page back from the tier or as zeros, true if it was in the tier
+static bool tier_fill(char* const page) {
+	tier_page** const slot = tier_pages + (page - (char*)base_bigmaac) / page_size;
+	tier_page* const t = *slot;
+	if (t == NULL) {
+		memset(tier_buffer, 0, page_size);
+	} else if (t->length == 0 || lz4_decompress(t->data, tier_buffer, t->length, page_size) != (int)page_size) {
+		memset(tier_buffer, 0, page_size);  // all zero
+	}
+	struct uffdio_copy copy = {.dst = (uintptr_t)page, .src = (uintptr_t)tier_buffer, .len = page_size, .mode = 0};
+	if (ioctl(tier_fd, UFFDIO_COPY, &copy) != 0 && errno == EEXIST) {  // brought in by someone else, wake whoever waits on it
+		struct uffdio_range range = {.start = (uintptr_t)page, .len = page_size};
+		ioctl(tier_fd, UFFDIO_WAKE, &range);
+	}
+	if (t == NULL) {
+		return false;
+	}
+	tier_bytes -= page_size;
+	tier_stored -= t->length;
+	if (t != &tier_zero) {
+		real_free((size_t)t);
+	}
+	*slot = NULL;
+	return true;
+}
+
+// move the resident pages of a victim into the tier, returns the bytes that left RAM
+static size_t tier_evict(const rss_victim* const v) {
+	if (tier_fd < 0 || v->chunk == NULL || v->chunk < (char*)base_bigmaac || v->chunk >= (char*)end_bigmaac) {
+		return 0;  // tier_pages only has slots for the bigmaac range
+	}
+	unsigned char vec[TIER_BATCH_PAGES];
+	const size_t batch_size = TIER_BATCH_PAGES * page_size;
+	size_t moved = 0;
+	bool registered = false;
+	for (char* batch = v->ptr; batch < v->ptr + v->size; batch += batch_size) {
+		const size_t len = (size_t)(v->ptr + v->size - batch) < batch_size ? (size_t)(v->ptr + v->size - batch) : batch_size;
+		pthread_mutex_lock(&tier_lock);
+		if (tier_stored >= tier_limit || !tier_chunk_in_use(v->chunk, batch + len)) {
+			pthread_mutex_unlock(&tier_lock);
+			break;
+		}
+		if (!registered) {  // the whole chunk, registering part of a mapping would split it
+			const node* const n = heap_find_node(v->chunk);
+			struct uffdio_register reg = {.range = {.start = (uintptr_t)n->ptr, .len = n->size},
+			                              .mode = UFFDIO_REGISTER_MODE_MISSING | UFFDIO_REGISTER_MODE_WP};
+			registered = ioctl(tier_fd, UFFDIO_REGISTER, &reg) == 0;
+		}
+		if (!registered || mincore(batch, len, (void*)vec) != 0 || tier_protect(batch, len, true) != 0) {
+			pthread_mutex_unlock(&tier_lock);
+			break;
+		}
+
+		tier_page** const slots = tier_pages + (batch - (char*)base_bigmaac) / page_size;
+		char* punch = NULL;  // start of the run of pages to punch out
+		for (size_t i = 0; i <= len / page_size; i++) {
+			char* const page = batch + i * page_size;
+			bool take = false;
+			if (i < len / page_size && (vec[i] & 1) && slots[i] == NULL && tier_stored < tier_limit) {
+				const uint64_t* const words = (const uint64_t*)page;
+				size_t w = 0;
+				while (w < page_size / sizeof(uint64_t) && words[w] == 0) {
+					w++;
+				}
+				int length = 0;
+				if (w < page_size / sizeof(uint64_t)) {
+					length = lz4_compress == NULL ? 0 : lz4_compress(page, tier_buffer, page_size, page_size / TIER_MAX_RATIO);
+					length = length > 0 ? length : -1;
+				}
+				tier_page* const t = length < 0 ? NULL : length == 0 ? &tier_zero : (tier_page*)real_malloc(sizeof(tier_page) + length);
+				if (t != NULL) {
+					if (t != &tier_zero) {
+						t->length = length;
+						memcpy(t->data, tier_buffer, length);
+					}
+					slots[i] = t;
+					tier_bytes += page_size;
+					tier_stored += length;
+					take = true;
+				}
+			}
+			if (take && punch == NULL) {
+				punch = page;
+			} else if (!take && punch != NULL) {
+				madvise(punch, page - punch, MADV_REMOVE);
+				moved += page - punch;
+				punch = NULL;
+			}
+		}
+		tier_protect(batch, len, false);  // wakes up writers, their page is missing now and gets filled
+		pthread_mutex_unlock(&tier_lock);
+	}
+	return moved;
+}
+
+static void* tier_worker(void* const arg) {
+	struct uffd_msg msgs[16];
+	for (;;) {
+		const ssize_t r = read(tier_fd, msgs, sizeof(msgs));
+		if (r <= 0) {
+			if (r < 0 && (errno == EINTR || errno == EAGAIN)) {
+				continue;
+			}
+			fprintf(stderr, "BigMaac: compressed tier stopped %s\n", strerror(errno));
+			return NULL;
+		}
+		for (size_t i = 0; i < r / sizeof(struct uffd_msg); i++) {
+			if (msgs[i].event != UFFD_EVENT_PAGEFAULT) {
+				continue;
+			}
+			char* const page = (char*)(uintptr_t)(msgs[i].arg.pagefault.address & ~(uint64_t)(page_size - 1));
+			pthread_mutex_lock(&tier_lock);
+			if (msgs[i].arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP) {  // evicted meanwhile, the write retries on a missing page
+				tier_protect(page, page_size, false);
+			} else if (tier_fill(page)) {  // neighbours are likely next
+				for (int j = 1; j <= TIER_FAULT_AROUND && page + j * page_size < (char*)end_bigmaac; j++) {
+					if (tier_pages[(page + j * page_size - (char*)base_bigmaac) / page_size] != NULL) {
+						tier_fill(page + j * page_size);
+					}
+				}
+			}
+			pthread_mutex_unlock(&tier_lock);
+		}
+	}
+	return NULL;
+}
+
+// caller holds tier_lock and the bigmaac lock, copy every page in the tier back into its chunk
+static void tier_restore(void) {
+	if (tier_fd < 0) {
+		return;
+	}
+	for (node* n = arena_bigmaacs.head->next; n != NULL && tier_bytes > 0; n = n->next) {
+		if (n->in_use == FREE) {  // KEPT chunks are in the journal as well
+			continue;
+		}
+		tier_page** const slots = tier_pages + (n->ptr - (char*)base_bigmaac) / page_size;
+		for (size_t i = 0; i < n->size / page_size; i++) {
+			if (slots[i] != NULL) {
+				tier_fill(n->ptr + i * page_size);
+			}
+		}
+	}
+}
+#else
+static bool tier_start(void) {
+	fprintf(stderr, "BigMaac: built without userfaultfd, no compressed tier\n");
+	return false;
+}
+static void tier_restore(void) {}
+static void tier_begin(char* const ptr, const size_t size, const bool restore) {}
+static void tier_end(void) {}
+static size_t tier_evict(const rss_victim* const v) { return 0; }
+static void* tier_worker(void* const arg) { return NULL; }
+#endif
+
+// BigMaac adaptive thresholds
+// With BIGMAAC_ADAPTIVE a helper thread moves the cutoffs every BIGMAAC_ADAPTIVE_INTERVAL ms, keeping them within
+// [BIGMAAC_ADAPTIVE_LOW, BIGMAAC_ADAPTIVE_HIGH]. When BigMaac's mappings near vm.max_map_count the bigmaac cutoff
+// goes above the median size of the recent bigmaacs, so that half of them become fries, and comes back down once
+// there is room again. A fragmented fries heap lowers it so the large fries get mappings of their own. Above
+// BIGMAAC_RSS_LIMIT the fry cutoff is halved so more of the heap can be paged out, without fries the bigmaac one.
+// Neither cutoff moves past its start value in the direction it only goes to relieve pressure.
+
+static size_t adaptive_halve(const size_t size, const size_t low) { return size / 2 < low ? (size > low ? low : size) : size / 2; }
+
+static size_t adaptive_double(const size_t size, const size_t high) { return size > high / 2 ? (size < high ? high : size) : size * 2; }
+
+static void* adaptive_worker(void* const arg) {
+	const size_t start_fry = min_size_fry;
+	const size_t start_bigmaac = min_size_bigmaac;
+	const bool fries = start_fry < start_bigmaac;  // else they are disabled and the fry cutoff follows the bigmaac one
+	long max_maps = 65530;                          // the kernel default
+	FILE* const f = fopen("/proc/sys/vm/max_map_count", "r");
+	if (f != NULL) {
+		if (fscanf(f, "%ld", &max_maps) != 1) {
+			max_maps = 65530;
+		}
+		fclose(f);
+	}
+
+	unsigned long long seen[ADAPTIVE_SIZE_CLASSES] = {0};
+	const struct timespec interval = {.tv_sec = adaptive_interval_ms / 1000, .tv_nsec = (adaptive_interval_ms % 1000) * 1000000L};
+	for (;;) {
+		nanosleep(&interval, NULL);
+		size_t fry = min_size_fry;
+		size_t bigmaac = min_size_bigmaac;
+
+		// bigmaacs made since the last look, by size class
+		unsigned long long recent[ADAPTIVE_SIZE_CLASSES];
+		unsigned long long total = 0;
+		for (int c = 0; c < ADAPTIVE_SIZE_CLASSES; c++) {
+			const unsigned long long count = __atomic_load_n(&counters_bigmaacs.size_classes[c], __ATOMIC_RELAXED);
+			recent[c] = count - seen[c];
+			seen[c] = count;
+			total += recent[c];
+		}
+
+		const long maps = __atomic_load_n(&active_mmaps, __ATOMIC_RELAXED);
+		if (maps > max_maps / 100 * ADAPTIVE_MAPS_HIGH) {
+			// only while bigmaacs are still being made, raising the cutoff does nothing for those there are
+			size_t target = total > 0 ? adaptive_double(bigmaac, adaptive_high) : bigmaac;
+			unsigned long long below = 0;
+			for (int c = 0; c < ADAPTIVE_SIZE_CLASSES && total > 0; c++) {
+				below += recent[c];
+				if (below * 2 >= total) {  // class c holds sizes below 2^c
+					target = c < 63 && ((size_t)1 << c) > target ? (size_t)1 << c : target;
+					break;
+				}
+			}
+			bigmaac = target < adaptive_high ? target : adaptive_high;
+		} else if (maps < max_maps / 100 * ADAPTIVE_MAPS_LOW && bigmaac > start_bigmaac) {
+			bigmaac = adaptive_halve(bigmaac, start_bigmaac);
+		} else if (fries && maps < max_maps / 100 * ADAPTIVE_MAPS_HIGH / 2 && bigmaac_fragmentation(BIGMAAC_ARENA_FRIES) > ADAPTIVE_FRAGMENTED) {
+			bigmaac = adaptive_halve(bigmaac, adaptive_low > fry ? adaptive_low : fry);
+		} else if (fries && bigmaac < start_bigmaac && bigmaac_fragmentation(BIGMAAC_ARENA_FRIES) < ADAPTIVE_FRAGMENTED / 2) {
+			bigmaac = adaptive_double(bigmaac, start_bigmaac);
+		}
+
+		if (rss_limit > 0) {
+			const size_t usage = rss_usage();
+			if (usage > rss_limit) {
+				if (fries) {
+					fry = adaptive_halve(fry, adaptive_low);
+				} else {
+					bigmaac = adaptive_halve(bigmaac, adaptive_low);
+				}
+			} else if (usage < rss_limit / 2 && fries && fry < start_fry) {
+				fry = adaptive_double(fry, start_fry);
+			} else if (usage < rss_limit / 2 && !fries && bigmaac < start_bigmaac) {
+				bigmaac = adaptive_double(bigmaac, start_bigmaac);
+			}
+		}
+		if (!fries || fry > bigmaac) {
+			fry = bigmaac;
+		}
+
+		if (fry != min_size_fry || bigmaac != min_size_bigmaac) {
+			__atomic_store_n(&min_size_fry, fry, __ATOMIC_RELAXED);
+			__atomic_store_n(&min_size_bigmaac, bigmaac, __ATOMIC_RELAXED);
+			pass_through_update();
+			fprintf(stderr, "BigMaac: fry cutoff %zu, bigmaac cutoff %zu (%ld mappings)\n", fry, bigmaac, maps);
+		}
+	}
+	return NULL;
+}
+
+// BigMaac tracing
+// With BIGMAAC_TRACE set every allocation and free of a BigMaac chunk is recorded in a ring buffer of the
+// calling thread, without locks: only the owning thread moves head and only the flush moves tail. A
+// helper thread writes the rings out every TRACE_FLUSH_US as raw trace_event blocks (bigmaac_trace.h),
+// or as soon as a ring is half full, together with /proc/self/maps so bigmaac_trace can attribute sampled
+// backtraces to call sites. Events that find their ring full are dropped and counted.
+
+FORCE_INLINE uint64_t trace_now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// start time of an operation to record, 0 if it will not be recorded
+FORCE_INLINE uint64_t trace_start(void) { return trace_fd < 0 || thread_tracing ? 0 : trace_now(); }
+
+// site is the return address of the entry point recording, the call site in the application
+static __attribute__((noinline)) void trace_record(const int op, const uint64_t start, void* const ptr, const size_t size, void* const site) {
+	if (start == 0 || ptr < base_fries || ptr >= end_bigmaac) {
+		return;
+	}
+	thread_tracing = true;
+	trace_ring* const ring = trace_ring_for_thread();
+	if (ring == NULL) {
+		thread_tracing = false;
+		return;
+	}
+	const uint64_t head = ring->head;
+	const uint64_t queued = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (queued >= TRACE_RING_SIZE) {
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+		thread_tracing = false;
+		return;
+	}
+	if (queued == TRACE_RING_SIZE / 2) {
+		pthread_cond_signal(&trace_cond);
+	}
+
+	trace_event* const e = &ring->events[head % TRACE_RING_SIZE];
+	const uint64_t now = trace_now();
+	*e = (trace_event){.time_ns = now, .ptr = (uintptr_t)ptr, .size = size, .latency_ns = now - start, .op = op, .arena = ptr >= base_bigmaac};
+#if defined(__linux__)
+	e->tid = syscall(SYS_gettid);
+#endif
+	if (trace_backtrace > 0 && op != TRACE_FREE && thread_trace_count++ % trace_backtrace == 0) {  // allocations only
+		void* frame[TRACE_FRAMES + TRACE_SKIP_FRAMES];
+		const int n = backtrace(frame, TRACE_FRAMES + TRACE_SKIP_FRAMES);
+		int first = 0;  // skip the frames of BigMaac, as many as the entry point took to get here
+		while (first < n && first <= TRACE_SKIP_FRAMES && frame[first] != site) {
+			first++;
+		}
+		first = first < n && frame[first] == site ? first : 2;  // not found, this function and one entry point
+		for (int i = first; i < n && e->frames < TRACE_FRAMES; i++) {
+			e->frame[e->frames++] = (uintptr_t)frame[i];
+		}
+	}
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	thread_tracing = false;
+}
+
+static trace_ring* trace_ring_for_thread(void) {
+	if (thread_trace_ring != NULL) {
+		return thread_trace_ring;
+	}
+	for (trace_ring* r = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {  // one a finished thread left
+		int unowned = 0;
+		if (__atomic_compare_exchange_n(&r->owned, &unowned, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			thread_trace_ring = r;
+			break;
+		}
+	}
+	if (thread_trace_ring == NULL) {
+		trace_ring* const r = (trace_ring*)meta_map(sizeof(trace_ring));  // zero filled
+		if (r == NULL) {
+			return NULL;
+		}
+		r->owned = 1;
+		r->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&trace_rings, &r->next, r, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		}
+		thread_trace_ring = r;
+	}
+	pthread_setspecific(trace_key, thread_trace_ring);  // handed back on thread exit
+	return thread_trace_ring;
+}
+
+static void trace_release(void* const ring) {
+	thread_trace_ring = NULL;
+	__atomic_store_n(&((trace_ring*)ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+// caller holds trace_lock, or is the only one writing
+static void trace_write(const uint32_t kind, const void* const data, const size_t length) {
+	const trace_block block = {.kind = kind, .length = length};
+	if (write(trace_fd, &block, sizeof(block)) != sizeof(block) || (length > 0 && write(trace_fd, data, length) != (ssize_t)length)) {
+		fprintf(stderr, "BigMaac: failed to write trace %s\n", strerror(errno));
+	}
+}
+
+static void trace_write_maps(void) {
+	const int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+	char buffer[4096];
+	pthread_mutex_lock(&trace_lock);
+	trace_write(TRACE_MAPS_START, NULL, 0);
+	for (ssize_t n; (n = read(fd, buffer, sizeof(buffer))) > 0;) {
+		trace_write(TRACE_MAPS, buffer, n);
+	}
+	pthread_mutex_unlock(&trace_lock);
+	close(fd);
+}
+
+static void trace_flush(void) {
+	pthread_mutex_lock(&trace_lock);
+	uint64_t dropped = 0;
+	for (trace_ring* r = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		const uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint64_t tail = r->tail;
+		while (tail < head) {  // at most two pieces, up to the end of the ring and from its start
+			const uint64_t index = tail % TRACE_RING_SIZE;
+			const uint64_t n = head - tail < TRACE_RING_SIZE - index ? head - tail : TRACE_RING_SIZE - index;
+			trace_write(TRACE_EVENTS, &r->events[index], n * sizeof(trace_event));
+			tail += n;
+		}
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+		dropped += __atomic_exchange_n(&r->dropped, 0, __ATOMIC_RELAXED);
+	}
+	if (dropped > 0) {
+		trace_write(TRACE_DROPPED, &dropped, sizeof(dropped));
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static void* trace_worker(void* const arg) {
+	for (;;) {
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += TRACE_FLUSH_US * 1000;
+		until.tv_sec += until.tv_nsec / 1000000000;
+		until.tv_nsec %= 1000000000;
+		pthread_mutex_lock(&trace_lock);
+		pthread_cond_timedwait(&trace_cond, &trace_lock, &until);
+		pthread_mutex_unlock(&trace_lock);
+		trace_flush();
+	}
+	return NULL;
+}
+
+// at exit, write what is left and the final maps so libraries loaded later can be resolved too
+static void trace_finish(void) {
+	trace_flush();
+	trace_write_maps();
+}
+
+// BigMaac NUMA
+// With BIGMAAC_NUMA the fry sub-arenas are dealt out over the nodes and each prefers its node's memory,
+// a thread allocates from the sub-arenas of the node it first allocated on. There is one bigmaac arena,
+// but every new bigmaac prefers the node of the thread that made it. A template on a block device
+// attached to a node, the NVMe drive next to the CPU, is used for the bigmaacs of that node's threads.
+
+static void numa_init(void) {
+#if defined(BIGMAAC_NUMA)
+	char online[256] = "";
+	FILE* const f = fopen("/sys/devices/system/node/online", "r");  // like 0-1,4
+	if (f != NULL) {
+		if (fgets(online, sizeof(online), f) == NULL) {
+			online[0] = '\0';
+		}
+		fclose(f);
+	}
+	int highest = -1;
+	for (char* p = online; *p != '\0';) {
+		if (*p >= '0' && *p <= '9') {
+			const int node = strtol(p, &p, 10);
+			highest = node > highest ? node : highest;
+		} else {
+			p++;
+		}
+	}
+	if (highest < 0 || highest >= MAX_NUMA_NODES) {
+		fprintf(stderr, "BigMaac: cannot tell the NUMA nodes, BIGMAAC_NUMA is off\n");
+		numa = false;
+		return;
+	}
+	n_numa_nodes = highest + 1;
+
+	// every node gets the same number of sub-arenas
+	const int max_arenas = MAX_FRY_ARENAS - MAX_FRY_ARENAS % n_numa_nodes;
+	n_fry_arenas = SIZE_TO_MULTIPLE(n_fry_arenas, n_numa_nodes);
+	n_fry_arenas = n_fry_arenas > max_arenas ? max_arenas : n_fry_arenas;
+
+	for (int i = 0; i < n_templates; i++) {
+		templates[i].numa_node = numa_node_of_dir(templates[i].dir);
+		if (templates[i].numa_node >= 0 && templates[i].numa_node < n_numa_nodes) {
+			numa_template_nodes |= 1ull << templates[i].numa_node;
+			fprintf(stderr, "BigMaac: %s is on NUMA node %d\n", templates[i].dir, templates[i].numa_node);
+		}
+	}
+	fprintf(stderr, "BigMaac: %d NUMA nodes, %d fry sub-arenas\n", n_numa_nodes, n_fry_arenas);
+#else
+	fprintf(stderr, "BigMaac: NUMA is not supported on this platform\n");
+	numa = false;
+#endif
+}
+
+// node of the block device dir is on, -1 when it is not attached to one or not a block device at all
+static int numa_node_of_dir(const char* const dir) {
+#if defined(BIGMAAC_NUMA)
+	struct stat st;
+	if (stat(dir, &st) != 0) {
+		return -1;
+	}
+	// the disk or the disk of a partition, whose device is the PCI function, the NVMe controller or the virtio device on it
+	static const char* const paths[] = {"device/numa_node",    "device/device/numa_node",    "device/../numa_node",
+	                                    "../device/numa_node", "../device/device/numa_node", "../device/../numa_node"};
+	for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+		char path[256];
+		snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/%s", major(st.st_dev), minor(st.st_dev), paths[i]);
+		FILE* const f = fopen(path, "r");
+		int node = -1;
+		if (f != NULL) {
+			if (fscanf(f, "%d", &node) != 1) {
+				node = -1;
+			}
+			fclose(f);
+		}
+		if (node >= 0) {
+			return node;
+		}
+	}
+#endif
+	return -1;
+}
+
+// have the pages of [ptr, ptr + size) that are not in memory yet come from node, as far as it has room
+static void numa_bind(void* const ptr, const size_t size, const int node) {
+#if defined(BIGMAAC_NUMA)
+	if (!numa) {
+		return;
+	}
+	const unsigned long long mask = 1ull << node;
+	if (syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, &mask, MAX_NUMA_NODES + 1, 0) != 0) {  // the kernel drops the last bit
+		fprintf(stderr, "BigMaac: mbind failed! %s\n", strerror(errno));
+	}
+#endif
+}
+
+// BigMaac huge pages
+// BIGMAAC_HUGEPAGES=thp asks for transparent huge pages on every mapping, which the kernel only honors
+// for shmem backed files (tmpfs templates, memfd). BIGMAAC_HUGEPAGES=hugetlb expects the template on a
+// hugetlbfs mount or memfd backing. Either way bigmaacs and the arenas are aligned to the huge page size.
+
+static size_t hugepage_size(void) {
+	size_t size = 0;
+	FILE* const meminfo = fopen("/proc/meminfo", "r");
+	if (meminfo != NULL) {
+		char line[256];
+		while (fgets(line, sizeof(line), meminfo) != NULL) {
+			if (sscanf(line, "Hugepagesize: %zu kB", &size) == 1) {
+				size *= 1024;
+				break;
+			}
+		}
+		fclose(meminfo);
+	}
+	return size >= page_size && size % page_size == 0 ? size : 1024 * 1024 * 2;
+}
+
+static void hugepage_report(void) {
+#if defined(__linux__)
+	struct statfs fs;
+	// what the backing files are made of, from the fries' first file or else the template directory
+	const int ret = n_stripes > 0 && stripes[0].fd >= 0 ? fstatfs(stripes[0].fd, &fs) : statfs(templates[0].dir, &fs);
+	if (ret != 0) {
+		fprintf(stderr, "BigMaac: cannot tell if huge pages are used\n");
+		return;
+	}
+
+	if (hugepages == HUGEPAGES_HUGETLB) {
+		if (fs.f_type == 0x958458f6) {  // HUGETLBFS_MAGIC
+			fprintf(stderr, "BigMaac: using huge pages of %zu KB from hugetlbfs\n", bigmaac_multiple / 1024);
+		} else {
+			fprintf(stderr, "BigMaac: backing files are not on hugetlbfs, no huge pages\n");
+		}
+		return;
+	}
+
+	char setting[256] = "";
+	FILE* const shmem = fopen("/sys/kernel/mm/transparent_hugepage/shmem_enabled", "r");
+	if (shmem != NULL) {
+		if (fgets(setting, sizeof(setting), shmem) == NULL) {
+			setting[0] = '\0';
+		}
+		fclose(shmem);
+	}
+	setting[strcspn(setting, "\n")] = '\0';
+	if (fs.f_type != 0x01021994) {  // TMPFS_MAGIC, memfd is shmem too
+		fprintf(stderr, "BigMaac: backing files are not on tmpfs, no transparent huge pages\n");
+	} else if (strstr(setting, "[never]") != NULL || strstr(setting, "[deny]") != NULL || setting[0] == '\0') {
+		fprintf(stderr, "BigMaac: transparent huge pages for shmem are disabled (%s), no huge pages\n", setting);
+	} else {
+		fprintf(stderr, "BigMaac: using transparent huge pages of %zu KB (shmem_enabled %s)\n", bigmaac_multiple / 1024, setting);
+	}
+#else
+	fprintf(stderr, "BigMaac: huge pages are not supported on this platform\n");
+#endif
+}
+
+// BigMaac helper functions
+
+// map [ptr, ptr + size) from a new file, returns the file which stays open or -1
+static int mmap_tmpfile(void* const ptr, const size_t size) {
+	fprintf(stderr, "BIGMAAC: make file %0.2f MB\n", ((double)size) / (1024.0 * 1024.0));
+	const int fd = file_pool_get();
+	if (fd < 0) {
+		return -1;
+	}
+
+	int ret = ftruncate(fd, size);  // resize the file
+	if (ret != 0) {
+		fprintf(stderr, "BigMaac: ftruncate failed! %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	void* ret_ptr = mmap(ptr, size, PROT_READ | PROT_WRITE, map_shared | MAP_FIXED, fd, 0);
+	if (ret_ptr == MAP_FAILED) {
+		close(fd);
+		size_t used_fries = 0;
+		for (int i = 0; i < n_fry_arenas; i++) {
+			used_fries += arena_fries[i].used;
+		}
+		fprintf(stderr, "BigMaac: mmap failed! mmap() [ active mmaps %d , bigmaac capacity free: %0.2f , fries capacity free: %0.2f, check /proc/sys/vm/max_map_count : %s\n", active_mmaps,
+		        1.0 - ((float)used_fries) / size_fries, 1.0 - ((float)arena_bigmaacs.used) / size_bigmaac, strerror(errno));
+		return -1;
+	}
+	__atomic_fetch_add(&active_mmaps, 1, __ATOMIC_RELAXED);
+	mmap_advise(ptr, size);
+	return fd;  // kept for growing the chunk in place and for forked children
+}
+
+// map [ptr, ptr + size) from the file of the chunk starting at base, the file is grown to cover it,
+// a chunk whose file was not kept open gets a new one for it
+static int mmap_extend(const int fd, char* const base, char* const ptr, const size_t size) {
+	if (fd < 0) {
+		const int tail = mmap_tmpfile(ptr, size);
+		if (tail < 0) {
+			return -1;
+		}
+		close(tail);
+		return 0;
+	}
+	if (ftruncate(fd, ptr + size - base) != 0) {
+		fprintf(stderr, "BigMaac: ftruncate failed! %s\n", strerror(errno));
+		return -1;
+	}
+	if (mmap(ptr, size, PROT_READ | PROT_WRITE, map_shared | MAP_FIXED, fd, ptr - base) == MAP_FAILED) {
+		fprintf(stderr, "BigMaac: mmap failed! %s, check /proc/sys/vm/max_map_count\n", strerror(errno));
+		return -1;
+	}
+	__atomic_fetch_add(&active_mmaps, 1, __ATOMIC_RELAXED);
+	mmap_advise(ptr, size);
+	return 0;
+}
+
+// the file of a bigmaac stays open while that leaves most of RLIMIT_NOFILE to the application, it is closed
+// and -1 returned otherwise, the mapping keeps the file anyway
+static int fd_keep(const int fd) {
+	if (__atomic_add_fetch(&kept_fds, 1, __ATOMIC_RELAXED) > max_kept_fds) {
+		__atomic_fetch_sub(&kept_fds, 1, __ATOMIC_RELAXED);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void fd_drop(const int fd) {
+	if (fd >= 0) {
+		close(fd);
+		__atomic_fetch_sub(&kept_fds, 1, __ATOMIC_RELAXED);
+	}
+}
+
+// map [ptr, ptr + size) from one file per template, stripe k coming from the file of template k % n_templates,
+// stripes are BIGMAAC_STRIPE_SIZE or else size / n_templates so each template gets one piece
+static int mmap_striped(char* const ptr, const size_t size) {
+	if (n_templates == 1 || backing == BACKING_MEMFD) {
+		const int fd = mmap_tmpfile(ptr, size);
+		return fd >= 0 && stripe_add(ptr, size, fd, 0) ? 0 : -1;
+	}
+	size_t stripe = stripe_size > 0 ? stripe_size : (size + n_templates - 1) / n_templates;
+	stripe = SIZE_TO_MULTIPLE(stripe, bigmaac_multiple);
+	const size_t n_stripes = (size + stripe - 1) / stripe;
+	const int n_files = n_stripes < (size_t)n_templates ? (int)n_stripes : n_templates;
+	fprintf(stderr, "BIGMAAC: make %d files %0.2f MB in stripes of %0.2f MB\n", n_files, ((double)size) / (1024.0 * 1024.0), ((double)stripe) / (1024.0 * 1024.0));
+
+	int fds[MAX_TEMPLATES];
+	int opened = 0;
+	for (; opened < n_files; opened++) {
+		fds[opened] = tmpfile_open_at(&templates[opened]);
+		const size_t file_size = (n_stripes - opened + n_files - 1) / n_files * stripe;  // the last stripe may be short, the file is not
+		if (fds[opened] < 0 || ftruncate(fds[opened], file_size) != 0) {
+			fprintf(stderr, "BigMaac: failed to make the file on %s %s\n", templates[opened].path, strerror(errno));
+			break;
+		}
+	}
+	int ret = opened == n_files ? 0 : -1;
+	for (size_t k = 0; ret == 0 && k < n_stripes; k++) {
+		const size_t length = size - k * stripe < stripe ? size - k * stripe : stripe;
+		const off_t offset = (off_t)(k / n_files * stripe);
+		if (mmap(ptr + k * stripe, length, PROT_READ | PROT_WRITE, map_shared | MAP_FIXED, fds[k % n_files], offset) == MAP_FAILED) {
+			fprintf(stderr, "BigMaac: mmap failed! %s, check /proc/sys/vm/max_map_count\n", strerror(errno));
+			ret = -1;
+			break;
+		}
+		__atomic_fetch_add(&active_mmaps, 1, __ATOMIC_RELAXED);
+		if (!stripe_add(ptr + k * stripe, length, fds[k % n_files], offset)) {
+			ret = -1;
+			break;
+		}
+	}
+	for (int i = 0; ret < 0 && i <= opened && i < n_files; i++) {  // kept for forked children, BigMaac fails to load otherwise
+		if (fds[i] >= 0) {
+			close(fds[i]);
+		}
+	}
+	if (ret == 0) {
+		mmap_advise(ptr, size);
+	}
+	return ret;
+}
+
+// remember a mapping of the fries or the store, only called while loading
+static bool stripe_add(char* const ptr, const size_t size, const int fd, const off_t offset) {
+	if (n_stripes == stripes_capacity) {
+		const size_t capacity = stripes_capacity == 0 ? page_size / sizeof(stripe) : stripes_capacity * 2;
+		stripe* const grown = (stripe*)meta_map(sizeof(stripe) * capacity);
+		if (grown == NULL) {
+			return false;
+		}
+		if (stripes != NULL) {
+			memcpy(grown, stripes, sizeof(stripe) * n_stripes);
+			meta_unmap(stripes, sizeof(stripe) * stripes_capacity);
+		}
+		stripes = grown;
+		stripes_capacity = capacity;
+	}
+	stripes[n_stripes++] = (stripe){.ptr = ptr, .size = size, .fd = fd, .offset = offset};
+	return true;
+}
+
+// huge pages and the default access hint of the arena for a new mapping
+static void mmap_advise(void* const ptr, const size_t size) {
+#if defined(MADV_HUGEPAGE)
+	if (hugepages == HUGEPAGES_THP && madvise(ptr, size, MADV_HUGEPAGE) != 0) {
+		fprintf(stderr, "BigMaac: madvise(MADV_HUGEPAGE) failed! %s\n", strerror(errno));
+	}
+#endif
+
+	const int advice = ptr < base_bigmaac ? advice_fries : advice_bigmaacs;
+	if (advice != BIGMAAC_NORMAL && advise_range(ptr, size, advice) != 0) {
+		fprintf(stderr, "BigMaac: madvise failed! %s\n", strerror(errno));
+	}
+}
+
+// a bigmaac or a fry as the caller decided, a zeroed chunk is only memset where it may hold old data, bigmaacs always start out on a new file
+// alignment is 0 or a power of two, chunks are always aligned to their arena's multiple
+static void* create_chunk(const bool bigmaac, size_t size, const bool zero, const size_t alignment) {
+	const size_t requested = size;
+	if (bigmaac || fries_inherited) {  // a child sharing the fries of its parent only makes bigmaacs
+		// page align the size requested
+		size = SIZE_TO_MULTIPLE(size, bigmaac_multiple);
+		const size_t align = alignment > bigmaac_multiple ? alignment : 0;
+		void* const p = align > 0 ? NULL : extent_get(size);
+		if (p != NULL) {
+			numa_bind(p, size, numa_node_for_thread());  // its pages were punched out, they fault in anew
+			return count_alloc(&counters_bigmaacs, requested, size, p);
+		}
+		node* const heap_chunk = arena_pop(&arena_bigmaacs, size, align, NULL);
+		if (heap_chunk == NULL) {
+			return NULL;
+		}
+		heap_chunk->fd = -1;
+		heap_chunk->shared = false;
+		heap_chunk->inherited = false;
+		heap_chunk->exported = false;
+		if (n_store_files > 0) {  // freed store space was punched out, so it reads as zero
+			heap_chunk->maps = 0;  // not bound, a policy per chunk would split the store's mappings into many
+			return count_alloc(&counters_bigmaacs, requested, size, heap_chunk->ptr);
+		}
+		const int fd = mmap_tmpfile(heap_chunk->ptr, size);
+		if (fd < 0) {
+			return NULL;
+		}
+		heap_chunk->fd = fd_keep(fd);
+		heap_chunk->maps = 1;
+		numa_bind(heap_chunk->ptr, size, numa_node_for_thread());
+		return count_alloc(&counters_bigmaacs, requested, size, heap_chunk->ptr);
+	}
+
+	size = SIZE_TO_MULTIPLE(size, fry_size_multiple);
+	const size_t align = alignment > 0 && fry_size_multiple % alignment != 0 ? alignment : 0;
+	if (size <= tcache_max_size && align == 0) {
+		void* const p = tcache_get(size);
+		if (p != NULL) {
+			if (zero) {  // cached chunks have been used before
+				memset(p, 0, requested);
+			}
+			return count_alloc(&counters_fries, requested, size, p);
+		}
+	}
+	const int first = fry_arena_for_thread();
+	for (int i = 0; i < n_fry_arenas * 2; i++) {  // fall over to the other sub-arenas of our node when ours is full, then to the rest
+		const int next = (first + i) % n_fry_arenas;
+		if ((next % n_numa_nodes == first % n_numa_nodes) != (i < n_fry_arenas)) {
+			continue;
+		}
+		size_t dirty = 0;
+		node* const heap_chunk = arena_pop(&arena_fries[next], size, align, &dirty);
+		if (heap_chunk != NULL) {
+			if (zero && dirty > 0) {
+				memset(heap_chunk->ptr, 0, dirty < requested ? dirty : requested);
+			}
+			return count_alloc(&counters_fries, requested, heap_chunk->size, heap_chunk->ptr);
+		}
+	}
+	return NULL;
+}
+
+// grow a chunk in place into the free space right behind it, the existing data is not touched
+static int grow_chunk(void* const ptr, size_t size) {
+	arena* const a = arena_of(ptr);
+	const bool bigmaac = a == &arena_bigmaacs;
+	const size_t multiple = bigmaac ? bigmaac_multiple : fry_size_multiple;
+	size = SIZE_TO_MULTIPLE(size, multiple);
+
+	arena_lock(a);
+	node* const n = heap_find_node(ptr);
+	const size_t old_size = n == NULL ? 0 : n->size;
+	if (n == NULL || n->inherited || (!bigmaac && fries_inherited) || heap_grow_node(a->head, n, size) < 0) {
+		pthread_mutex_unlock(&a->lock);
+		return -1;
+	}
+	a->used += size - old_size;
+	if (a->fresh < n->ptr + size) {
+		a->fresh = n->ptr + size;
+	}
+	verify_memory(a, 1);
+	pthread_mutex_unlock(&a->lock);
+
+	if (!bigmaac || n->maps == 0) {  // the fries file or the bigmaac store already covers the whole arena
+		return 0;
+	}
+
+	// the grown range belongs to this chunk now, so it can be mapped without the lock, from the end of its file
+	if (mmap_extend(n->fd, n->ptr, n->ptr + old_size, size - old_size) < 0) {
+		arena_lock(a);
+		node* const tail = heap_split_node(a->head, n, old_size);
+		if (tail != NULL) {
+			arena_free_node(a, tail);
+		}
+		pthread_mutex_unlock(&a->lock);
+		return -1;
+	}
+	n->maps++;
+	numa_bind(n->ptr + old_size, size - old_size, numa_node_for_thread());
+	return 0;
+}
+
+// cut a chunk down to size in place, a bigmaac also hands the cut off disk space back
+static int shrink_chunk(void* const ptr, size_t size) {
+	arena* const a = arena_of(ptr);
+	const bool bigmaac = a == &arena_bigmaacs;
+	const size_t multiple = bigmaac ? bigmaac_multiple : fry_size_multiple;
+	size = SIZE_TO_MULTIPLE(size, multiple);
+
+	arena_lock(a);
+	node* const n = heap_find_node(ptr);
+	// the tail of a bigmaac grown in place may be a mapping of its own, only cut single mappings, and
+	// importers of an exported one still map the tail of its file
+	const bool shrinkable = n != NULL && n->size > size && (!bigmaac || (n->maps <= 1 && !n->exported));
+	pthread_mutex_unlock(&a->lock);
+	if (!shrinkable) {
+		return -1;
+	}
+
+	if (bigmaac && unmap_chunk(n, n->ptr + size, n->size - size) < 0) {
+		return -1;
+	}
+
+	arena_lock(a);
+	node* const tail = heap_split_node(a->head, n, size);
+	const int r = tail == NULL ? -1 : arena_free_node(a, tail);
+	pthread_mutex_unlock(&a->lock);
+	return r;
+}
+
+#if defined(__linux__)
+// move a bigmaac backed by a single mapping by remapping its pages, the new tail is mapped from the end of its file
+static void* move_chunk(void* const ptr, size_t size) {
+	size = SIZE_TO_MULTIPLE(size, bigmaac_multiple);
+
+	arena_lock(&arena_bigmaacs);
+	node* const n = heap_find_node(ptr);
+	const bool movable = n != NULL && n->maps == 1 && !n->inherited;
+	pthread_mutex_unlock(&arena_bigmaacs.lock);
+	if (!movable) {
+		return NULL;
+	}
+
+	node* const m = arena_pop(&arena_bigmaacs, size, 0, NULL);
+	if (m == NULL) {
+		return NULL;
+	}
+	m->maps = 0;
+	m->fd = -1;  // the file stays with n until its pages have moved
+	m->shared = n->shared;
+	m->inherited = false;
+	m->exported = n->exported;
+	if (mmap_extend(n->fd, m->ptr, m->ptr + n->size, size - n->size) < 0) {
+		remove_chunk_with_ptr(m->ptr, NULL, 0);
+		return NULL;
+	}
+	m->maps = 1;
+	tier_begin(n->ptr, n->size, true);  // the userfaultfd registration does not move along
+	void* const r = mremap(n->ptr, n->size, n->size, MREMAP_MAYMOVE | MREMAP_FIXED, m->ptr);
+	tier_end();
+	if (r == MAP_FAILED) {
+		fprintf(stderr, "BigMaac: mremap failed! %s\n", strerror(errno));
+		remove_chunk_with_ptr(m->ptr, NULL, 0);
+		return NULL;
+	}
+	m->maps++;
+	m->fd = n->fd;
+	n->maps = 0;
+	log_bm("realloc Mmap[%p]%zu <--mremap-- Mmap[%p]%zu\n", m->ptr, size, n->ptr, n->size);
+
+	// the old range is a hole in the reservation now, fill it with PROT_NONE again before it is reused
+	if (mmap(ptr, n->size, PROT_NONE, MAP_ANONYMOUS | MAP_FIXED | MAP_PRIVATE, -1, 0) == MAP_FAILED) {
+		fprintf(stderr, "BigMaac: failed to reserve %p again %s\n", ptr, strerror(errno));
+	}
+	count_free(ptr);
+	arena_lock(&arena_bigmaacs);
+	arena_free_node(&arena_bigmaacs, n);
+	pthread_mutex_unlock(&arena_bigmaacs.lock);
+	return count_alloc(&counters_bigmaacs, size, size, m->ptr);
+}
+#endif
+
+FORCE_INLINE void memblock_copy(void* const old_ptr, void* const new_ptr, const size_t old_size, const size_t new_size, const bool from_heap) {
+	const size_t m = (old_size < new_size) ? old_size : new_size;
+	memcpy(new_ptr, old_ptr, m);
+	__atomic_fetch_add(&realloc_bytes_copied, m, __ATOMIC_RELAXED);
+#ifdef DEBUG
+	if (from_heap)
+		log_bm("realloc Mmap[%p]%zu <--%ld-- Heap[%p]%zu\n", new_ptr, new_size, m, old_ptr, old_size);
+	else
+		log_bm("realloc Mmap[%p]%zu <--%ld-- Mmap[%p]%zu\n", new_ptr, new_size, m, old_ptr, old_size);
+#endif
+}
+
+static int remove_chunk_with_ptr(void* const ptr, void* const new_ptr, const size_t new_size) {
+	arena* const a = arena_of(ptr);
+	arena_lock(a);
+
+	node* n = heap_find_node(ptr);
+	if (n == NULL || n->in_use != IN_USE) {  // or freed before
+		fprintf(stderr, "BigMaac: Cannot find node in BigMaac\n");
+		pthread_mutex_unlock(&a->lock);
+		return 0;
+	}
+
+	// the node is in use so nobody else touches it, copy and unmap without holding up the arena
+	pthread_mutex_unlock(&a->lock);
+	if (new_ptr != NULL) {
+		memblock_copy(n->ptr, new_ptr, n->size, new_size, false);
+	}
+	if (a == &arena_bigmaacs && unmap_chunk(n, n->ptr, n->size) < 0) {
+		return 0;
+	}
+	arena_lock(a);
+
+	const int r = arena_free_node(a, n);
+	pthread_mutex_unlock(&a->lock);
+
+	if (r < 0) {
+		return r;
+	}
+
+	return 1;
+}
+
+// BigMaac C library memory functions
+
+// the entry points hand what they do not pass through to a _chunk function with their return address,
+// the call site their backtraces start at
+
+void* PREFIX(malloc)(size_t size) {
+	if (__builtin_expect(size < __atomic_load_n(&pass_through_below, __ATOMIC_ACQUIRE), 1)) {
+		return real_malloc(size);
+	}
+	return malloc_chunk(size, __builtin_return_address(0));
+}
+
+static void* malloc_chunk(const size_t size, void* const site) {
+	if (!init_wait() || size == 0) {
+		return real_malloc == NULL ? NULL : real_malloc(size);  // NULL to dlsym() while it is being looked up
+	}
 
-	if (load_state == NOT_LOADED || real_malloc == NULL) {
-		bigmaac_init();
+	size_t fry, bigmaac;
+	thread_thresholds(&fry, &bigmaac);
+	if (size > fry) {
+		const uint64_t start = trace_start();
+		void* p = create_chunk(size > bigmaac, size, false, 0);
+		if (p == NULL) {
+			OOM();
+			return NULL;
+		}
+		trace_record(TRACE_MALLOC, start, p, size, site);
+		return p;
 	}
 
-	if (load_state != LOADED || count == 0 || size == 0) {
+	return real_malloc(size);
+}
+
+void* PREFIX(calloc)(size_t count, size_t size) {
+	size_t total;
+	const bool overflow = __builtin_mul_overflow(count, size, &total);
+	if (__builtin_expect(!overflow && total < __atomic_load_n(&pass_through_below, __ATOMIC_ACQUIRE), 1)) {
 		return real_calloc(count, size);
 	}
+	return calloc_chunk(count, size, __builtin_return_address(0));
+}
+
+static void* calloc_chunk(const size_t count, const size_t size, void* const site) {
+	size_t total;
+	const bool overflow = __builtin_mul_overflow(count, size, &total);
+	if (!init_wait() || count == 0 || size == 0) {
+		return real_calloc == NULL ? NULL : real_calloc(count, size);
+	}
+
+	if (overflow) {
+		errno = ENOMEM;
+		return NULL;
+	}
 
 	// library is loaded and count/size are reasonable
-	if (size > min_size_fry) {
-		void* p = create_chunk(size);
+	size_t fry, bigmaac;
+	thread_thresholds(&fry, &bigmaac);
+	if (total > fry) {
+		const uint64_t start = trace_start();
+		void* p = create_chunk(total > bigmaac, total, true, 0);
 		if (p == NULL) {
 			OOM();
 			return NULL;
 		}
-		if (size <= min_size_bigmaac) {  // its a fry
-			memset(p, 0, count * size);
-		}
+		trace_record(TRACE_CALLOC, start, p, total, site);
 		return p;
 	}
 
@@ -699,39 +4276,65 @@ void* PREFIX(calloc)(size_t count, size_t size) {
 void* PREFIX(reallocarray)(void* ptr, size_t size, size_t count) { return PREFIX(realloc)(ptr, size * count); }
 
 void* PREFIX(realloc)(void* ptr, size_t size) {
-	if (load_state == NOT_LOADED && real_malloc == NULL) {
-		bigmaac_init();
+	if (__builtin_expect(size < __atomic_load_n(&pass_through_below, __ATOMIC_ACQUIRE) && (ptr < base_fries || ptr >= end_bigmaac), 1)) {
+		return real_realloc(ptr, size);
 	}
+	const uint64_t start = ptr == NULL ? 0 : trace_start();  // realloc(NULL) is recorded as malloc
+	void* const p = realloc_chunk(ptr, size, __builtin_return_address(0));
+	trace_record(TRACE_REALLOC, start, p, size, __builtin_return_address(0));
+	return p;
+}
 
-	if (load_state != LOADED) {
-		return real_realloc(ptr, size);
+static void* realloc_chunk(void* ptr, size_t size, void* const site) {
+	if (!init_wait()) {
+		return real_realloc == NULL ? NULL : real_realloc(ptr, size);
 	}
 
 	if (ptr == NULL || size == 0) {
-		return PREFIX(malloc)(size);
+		return malloc_chunk(size, site);
 	}
 
+	size_t fry, bigmaac;
+	thread_thresholds(&fry, &bigmaac);
+
 	// currently managed by BigMaac
 	if (ptr >= base_fries && ptr < end_bigmaac) {
 		// check if already allocated is big enough
-		pthread_mutex_lock(&lock);
+		arena* const a = arena_of(ptr);
+		arena_lock(a);
 		node* n = heap_find_node(ptr);
-		if (n == NULL) {
+		if (n == NULL || n->in_use != IN_USE) {
 			fprintf(stderr, "BigMaac: Cannot find node in BigMaac\n");
-			pthread_mutex_unlock(&lock);
+			pthread_mutex_unlock(&a->lock);
 			return NULL;
 		}
-		pthread_mutex_unlock(&lock);
+		const size_t old_size = n->size;
+		const bool journaled = n->journaled;  // only grows in place, what the journal lists stays where it is
+		pthread_mutex_unlock(&a->lock);
+
+		// allocated memory is big enough, give back what is not needed anymore
+		if (old_size >= size && !journaled) {
+			shrink_chunk(ptr, size);
+			return ptr;
+		}
 
-		// allocated memory is big enough
-		if (n->size >= size) {
+		// stays in its arena, try to take over the free space behind it
+		if (old_size < size && (ptr >= base_bigmaac) == (size > bigmaac) && grow_chunk(ptr, size) == 0) {
 			return ptr;
 		}
+#if defined(__linux__)
+		if (ptr >= base_bigmaac && !journaled) {
+			void* const p = move_chunk(ptr, size);
+			if (p != NULL) {
+				return p;
+			}
+		}
+#endif
 
 		// existing chunk is not big enough
 		void* p = NULL;
-		if (size > min_size_fry) {
-			p = create_chunk(size);
+		if (size > fry) {
+			p = create_chunk(size > bigmaac, size, false, 0);
 			if (p == NULL) {
 				OOM();  // set errno
 			}
@@ -743,7 +4346,14 @@ void* PREFIX(realloc)(void* ptr, size_t size) {
 			return NULL;
 		}
 
-		int r = remove_chunk_with_ptr(ptr, p, size);  // Check if this pointer is>> address space reserved fr mmap
+		count_free(ptr);
+		if (journaled) {
+			memblock_copy(ptr, p, old_size, size, false);
+			if (persist_keep(ptr)) {
+				return p;
+			}
+		}
+		int r = remove_chunk_with_ptr(ptr, journaled ? NULL : p, size);  // Check if this pointer is>> address space reserved fr mmap
 		if (r < 0) {
 			OOM();
 			return NULL;
@@ -756,10 +4366,10 @@ void* PREFIX(realloc)(void* ptr, size_t size) {
 
 	// currently managed by system
 	// if (size>24570 && size<24577) { //debug pytest
-	if (size > min_size_fry) {
-		size_t old_size = MALLOCSIZE(ptr);
+	if (size > fry) {
+		size_t old_size = real_malloc_usable_size(ptr);
 
-		void* p = create_chunk(size);
+		void* p = create_chunk(size > bigmaac, size, false, 0);
 		if (p != NULL) {
 			memblock_copy(ptr, p, old_size, size, true);
 			real_free((size_t)ptr);
@@ -770,28 +4380,507 @@ void* PREFIX(realloc)(void* ptr, size_t size) {
 		return p;
 	}
 
-	// size <= min_size_fry
+	// size <= fry
 	return real_realloc(ptr, size);
 }
 
-void PREFIX(free)(void* ptr) {
-	if (load_state == NOT_LOADED && real_malloc == NULL) {
-		bigmaac_init();
+int PREFIX(posix_memalign)(void** memptr, size_t alignment, size_t size) {
+	if (__builtin_expect(size < __atomic_load_n(&pass_through_below, __ATOMIC_ACQUIRE), 1)) {
+		return real_posix_memalign(memptr, alignment, size);
+	}
+	return memalign_chunk(memptr, alignment, size, __builtin_return_address(0));
+}
+
+static int memalign_chunk(void** const memptr, const size_t alignment, const size_t size, void* const site) {
+	if (!init_wait()) {
+		return real_posix_memalign == NULL ? ENOMEM : real_posix_memalign(memptr, alignment, size);
+	}
+	size_t fry, bigmaac;
+	thread_thresholds(&fry, &bigmaac);
+	if (size <= fry) {
+		return real_posix_memalign(memptr, alignment, size);
+	}
+
+	if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+		return EINVAL;
+	}
+
+	// fries only line up with power of two alignments if their multiple is one too
+	if (size <= bigmaac && alignment > fry_size_multiple && alignment % fry_size_multiple != 0) {
+		return real_posix_memalign(memptr, alignment, size);
+	}
+
+	const uint64_t start = trace_start();
+	void* const p = create_chunk(size > bigmaac, size, false, alignment);
+	if (p == NULL) {
+		OOM();
+		return ENOMEM;
+	}
+	trace_record(TRACE_MEMALIGN, start, p, size, site);
+	*memptr = p;
+	return 0;
+}
+
+// alignments that are not a power of two are up to the system allocator, some round them up and some fail
+static void* aligned_real(void* (**const real)(size_t, size_t), const size_t alignment, const size_t size) {
+	init_wait();
+	if (*real == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return (*real)(alignment, size);
+}
+
+void* PREFIX(aligned_alloc)(size_t alignment, size_t size) {
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		return aligned_real(&real_aligned_alloc, alignment, size);
+	}
+	return aligned_chunk(alignment, size, __builtin_return_address(0));
+}
+
+static void* aligned_chunk(const size_t alignment, const size_t size, void* const site) {
+	void* p = NULL;
+	const int r = memalign_chunk(&p, alignment < sizeof(void*) ? sizeof(void*) : alignment, size, site);
+	if (r != 0) {
+		errno = r;
+		return NULL;
+	}
+	return p;
+}
+
+void* PREFIX(memalign)(size_t alignment, size_t size) {
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		return aligned_real(&real_memalign, alignment, size);
 	}
+	return aligned_chunk(alignment, size, __builtin_return_address(0));
+}
+
+void* PREFIX(valloc)(size_t size) {
+	init_wait();  // for page_size
+	return aligned_chunk(page_size, size, __builtin_return_address(0));
+}
+
+void* PREFIX(pvalloc)(size_t size) {
+	init_wait();
+	size = size == 0 ? page_size : SIZE_TO_MULTIPLE(size, page_size);
+	return aligned_chunk(page_size, size, __builtin_return_address(0));
+}
 
+void PREFIX(free)(void* ptr) {
 	// if ptr is managed by system or BigMaac is not loaded yet
-	if (load_state != LOADED || ptr < base_fries || ptr >= end_bigmaac) {
-		real_free((size_t)ptr);
+	if (__builtin_expect(__atomic_load_n(&load_state, __ATOMIC_ACQUIRE) != LOADED || ptr < base_fries || ptr >= end_bigmaac, 1)) {
+		if (real_free != NULL) {
+			real_free((size_t)ptr);
+		}
 		return;
 	}
 	// ptr is managed by BigMaac and library is fully loaded
-	int chunks_removed = remove_chunk_with_ptr(ptr, NULL, 0);  // Check if this pointer is>> address space reserved fr mmap
+	count_free(ptr);
+	if (trace_fd >= 0) {
+		const node* const n = heap_find_node(ptr);
+		trace_record(TRACE_FREE, trace_start(), ptr, n == NULL ? 0 : n->size, NULL);
+	}
+	if (persist_keep(ptr)) {
+		return;
+	}
+	int chunks_removed = free_chunk(ptr);  // Check if this pointer is>> address space reserved fr mmap
 	if (chunks_removed == 0) {
 		fprintf(stderr, "BigMaac: Free was called on pointer that was not alloc'd %p\n", ptr);
 		return;
 	}
 }
 
+// hand a chunk to the thread cache, the extent cache or back to its arena, 0 when it is not ours
+static int free_chunk(void* const ptr) {
+	if (ptr < end_fries ? tcache_put(ptr) : extent_put(ptr)) {
+		return 1;
+	}
+	return remove_chunk_with_ptr(ptr, NULL, 0);
+}
+
+size_t PREFIX(malloc_usable_size)(void* ptr) {
+	if (__atomic_load_n(&load_state, __ATOMIC_ACQUIRE) != LOADED || ptr < base_fries || ptr >= end_bigmaac) {
+		return ptr == NULL || real_malloc_usable_size == NULL ? 0 : real_malloc_usable_size(ptr);
+	}
+	// the node is in use and owned by the caller, so it can be looked at without a lock
+	node* const n = heap_find_node(ptr);
+	if (n == NULL || n->in_use != IN_USE) {
+		fprintf(stderr, "BigMaac: malloc_usable_size was called on pointer that was not alloc'd %p\n", ptr);
+		return 0;
+	}
+	return n->size;
+}
+
+#if !defined(NOTCOMPAT) && __SIZEOF_SIZE_T__ == 8 && __SIZEOF_LONG__ == 8
+// C++ operators new and delete by their mangled names (size_t is unsigned long), only where they were
+// looked up through LD_PRELOAD. Managed sizes go straight to BigMaac and the rest straight to the system
+// allocator, only a failed allocation is handed to the real operator for the new_handler and bad_alloc.
+
+static void* new_chunk(const size_t size, const size_t alignment, void* const site) {
+	const size_t align = alignment > sizeof(void*) ? alignment : 0;
+	if (__builtin_expect(align == 0 && size < __atomic_load_n(&pass_through_below, __ATOMIC_ACQUIRE), 1)) {
+		return real_malloc(size);
+	}
+
+	const bool loaded = init_wait();
+	size_t fry, bigmaac;
+	thread_thresholds(&fry, &bigmaac);
+	if (loaded && size > fry && (align <= fry_size_multiple || align % fry_size_multiple == 0 || size > bigmaac)) {
+		const uint64_t start = trace_start();
+		void* const p = create_chunk(size > bigmaac, size, false, align);
+		trace_record(TRACE_MALLOC, start, p, size, site);
+		return p;
+	}
+	if (real_malloc == NULL) {
+		return NULL;
+	}
+	void* p = NULL;
+	if (align == 0) {
+		p = real_malloc(size);
+	} else if (real_posix_memalign(&p, align, size) != 0) {
+		p = NULL;
+	}
+	return p;
+}
+
+static void* real_operator(const char* const symbol) {
+	void* const f = dlsym(RTLD_NEXT, symbol);
+	if (f == NULL) {
+		fprintf(stderr, "BigMaac: cannot find %s to fall back to\n", symbol);
+		abort();
+	}
+	return f;
+}
+
+#define NEW_OPERATOR(symbol)                                                      \
+	void* symbol(size_t size) {                                                   \
+		void* const p = new_chunk(size, 0, __builtin_return_address(0));          \
+		return p != NULL ? p : ((void* (*)(size_t))real_operator(#symbol))(size); \
+	}
+#define NEW_OPERATOR_ALIGNED(symbol)                                                                 \
+	void* symbol(size_t size, size_t alignment) {                                                    \
+		void* const p = new_chunk(size, alignment, __builtin_return_address(0));                     \
+		return p != NULL ? p : ((void* (*)(size_t, size_t))real_operator(#symbol))(size, alignment); \
+	}
+#define NEW_OPERATOR_NOTHROW(symbol)                                                                    \
+	void* symbol(size_t size, const void* nothrow) {                                                    \
+		void* const p = new_chunk(size, 0, __builtin_return_address(0));                                \
+		return p != NULL ? p : ((void* (*)(size_t, const void*))real_operator(#symbol))(size, nothrow); \
+	}
+#define NEW_OPERATOR_ALIGNED_NOTHROW(symbol)                                                                               \
+	void* symbol(size_t size, size_t alignment, const void* nothrow) {                                                     \
+		void* const p = new_chunk(size, alignment, __builtin_return_address(0));                                           \
+		return p != NULL ? p : ((void* (*)(size_t, size_t, const void*))real_operator(#symbol))(size, alignment, nothrow); \
+	}
+
+NEW_OPERATOR(_Znwm)                                   // operator new(size_t)
+NEW_OPERATOR(_Znam)                                   // operator new[](size_t)
+NEW_OPERATOR_ALIGNED(_ZnwmSt11align_val_t)            // operator new(size_t, align_val_t)
+NEW_OPERATOR_ALIGNED(_ZnamSt11align_val_t)            // operator new[](size_t, align_val_t)
+NEW_OPERATOR_NOTHROW(_ZnwmRKSt9nothrow_t)             // operator new(size_t, const nothrow_t&)
+NEW_OPERATOR_NOTHROW(_ZnamRKSt9nothrow_t)             // operator new[](size_t, const nothrow_t&)
+NEW_OPERATOR_ALIGNED_NOTHROW(_ZnwmSt11align_val_tRKSt9nothrow_t)  // operator new(size_t, align_val_t, const nothrow_t&)
+NEW_OPERATOR_ALIGNED_NOTHROW(_ZnamSt11align_val_tRKSt9nothrow_t)  // operator new[](size_t, align_val_t, const nothrow_t&)
+
+// every operator delete ends up in free(), sizes and alignments are known from the node or the system
+void _ZdlPv(void* ptr) { PREFIX(free)(ptr); }                                    // operator delete(void*)
+void _ZdaPv(void* ptr) { PREFIX(free)(ptr); }                                    // operator delete[](void*)
+void _ZdlPvm(void* ptr, size_t size) { PREFIX(free)(ptr); }                      // operator delete(void*, size_t)
+void _ZdaPvm(void* ptr, size_t size) { PREFIX(free)(ptr); }                      // operator delete[](void*, size_t)
+void _ZdlPvSt11align_val_t(void* ptr, size_t alignment) { PREFIX(free)(ptr); }   // operator delete(void*, align_val_t)
+void _ZdaPvSt11align_val_t(void* ptr, size_t alignment) { PREFIX(free)(ptr); }   // operator delete[](void*, align_val_t)
+void _ZdlPvmSt11align_val_t(void* ptr, size_t size, size_t alignment) { PREFIX(free)(ptr); }  // operator delete(void*, size_t, align_val_t)
+void _ZdaPvmSt11align_val_t(void* ptr, size_t size, size_t alignment) { PREFIX(free)(ptr); }  // operator delete[](void*, size_t, align_val_t)
+void _ZdlPvRKSt9nothrow_t(void* ptr, const void* nothrow) { PREFIX(free)(ptr); }  // operator delete(void*, const nothrow_t&)
+void _ZdaPvRKSt9nothrow_t(void* ptr, const void* nothrow) { PREFIX(free)(ptr); }  // operator delete[](void*, const nothrow_t&)
+void _ZdlPvSt11align_val_tRKSt9nothrow_t(void* ptr, size_t alignment, const void* nothrow) { PREFIX(free)(ptr); }
+void _ZdaPvSt11align_val_tRKSt9nothrow_t(void* ptr, size_t alignment, const void* nothrow) { PREFIX(free)(ptr); }
+#endif
+
+// BigMaac extensions
+
+int bigmaac_advise(void* ptr, size_t len, int advice) {
+	if (__atomic_load_n(&load_state, __ATOMIC_ACQUIRE) != LOADED || ptr < base_fries || ptr >= end_bigmaac) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	arena* const a = arena_of(ptr);
+	arena_lock(a);
+	const node* const n = index_find_chunk(a, (char*)ptr);  // ptr may point into an allocation
+	const size_t avail = n == NULL ? 0 : n->ptr + n->size - (char*)ptr;
+	char* const base = n == NULL ? NULL : n->ptr;
+	off_t offset = 0;
+	int fd = n == NULL || a != &arena_bigmaacs ? -1 : chunk_file(n, &offset);
+	const bool queue = io_engine == IO_ENGINE_URING && (advice == BIGMAAC_WILLNEED || advice == BIGMAAC_WRITEBACK);
+	const bool file = queue ? advice == BIGMAAC_WRITEBACK : file_advice(advice) >= 0;
+	fd = file && fd >= 0 && len <= avail ? fcntl(fd, F_DUPFD_CLOEXEC, 0) : -1;  // the chunk may be freed meanwhile
+	pthread_mutex_unlock(&a->lock);
+	if (n == NULL || len > avail) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len == 0) {
+		len = avail;
+	}
+
+	// madvise() works on whole pages, fries share theirs with their neighbours which is harmless for hints
+	const size_t multiple = hugepages == HUGEPAGES_HUGETLB ? bigmaac_multiple : page_size;
+	char* const start = (char*)ptr - ((uintptr_t)ptr % multiple);
+	const size_t length = SIZE_TO_MULTIPLE((size_t)((char*)ptr + len - start), multiple);
+	if (queue && io_queue_put((io_request){.ptr = start, .len = length, .advice = advice, .fd = fd, .offset = offset + (start - base)})) {
+		return 0;
+	}
+	int ret = advise_range(start, length, advice);
+	if (fd >= 0) {  // a bigmaac with a file, fries and imports only get the madvise()
+		const int err = ret == 0 && file_advice(advice) >= 0 ? posix_fadvise(fd, offset + (start - base), length, file_advice(advice)) : 0;
+		if (err != 0) {
+			errno = err;
+			ret = -1;
+		}
+		close(fd);
+	}
+	return ret;
+}
+
+static void* malloc_ex(const size_t size, const int flags, void* const site) {
+	const bool loaded = init_wait();
+
+	const size_t alignment = (size_t)1 << (flags & BIGMAAC_ALIGN_MASK);
+	const bool zero = (flags & BIGMAAC_ZERO) != 0;
+	const int force = flags & FORCE_FLAGS;
+	size_t fry = __atomic_load_n(&min_size_fry, __ATOMIC_RELAXED), big = __atomic_load_n(&min_size_bigmaac, __ATOMIC_RELAXED);
+	force_thresholds(force, &fry, &big);
+	if (force == 0 || !loaded || size == 0 || size <= fry) {  // placed like malloc() does, or in RAM
+		const bool ram = force != 0;
+		if (alignment <= _Alignof(max_align_t)) {
+			return ram ? (zero ? real_calloc(1, size) : real_malloc(size)) : zero ? calloc_chunk(1, size, site) : malloc_chunk(size, site);
+		}
+		void* p = NULL;
+		const int r = ram ? real_posix_memalign(&p, alignment, size) : memalign_chunk(&p, alignment, size, site);
+		if (r != 0) {
+			errno = r;
+			return NULL;
+		}
+		if (zero) {
+			memset(p, 0, size);
+		}
+		return p;
+	}
+
+	const bool bigmaac = size > big;
+	if (!bigmaac && alignment > fry_size_multiple && alignment % fry_size_multiple != 0) {  // fries cannot line up with it
+		errno = EINVAL;
+		return NULL;
+	}
+	const uint64_t start = trace_start();
+	void* const p = create_chunk(bigmaac, size, zero, alignment > sizeof(void*) ? alignment : 0);
+	if (p == NULL) {
+		OOM();
+		return NULL;
+	}
+	trace_record(zero ? TRACE_CALLOC : TRACE_MALLOC, start, p, size, site);
+	return p;
+}
+
+void* bigmaac_malloc_ex(size_t size, int flags) { return malloc_ex(size, flags, __builtin_return_address(0)); }
+
+int bigmaac_scope_begin(int flags) {
+	if (thread_scope_depth == MAX_SCOPES) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+	thread_scopes[thread_scope_depth++] = flags & FORCE_FLAGS;
+	if (thread_scope_depth == 1) {  // from now on every allocation has to look at the scopes
+		__atomic_fetch_add(&scopes_active, 1, __ATOMIC_RELAXED);
+		pass_through_update();
+	}
+	return 0;
+}
+
+int bigmaac_scope_end(void) {
+	if (thread_scope_depth == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (--thread_scope_depth == 0) {
+		__atomic_fetch_sub(&scopes_active, 1, __ATOMIC_RELAXED);
+		pass_through_update();
+	}
+	return 0;
+}
+
+int bigmaac_share(void* ptr) {
+	if (__atomic_load_n(&load_state, __ATOMIC_ACQUIRE) != LOADED || ptr < base_bigmaac || ptr >= end_bigmaac) {
+		errno = EINVAL;
+		return -1;
+	}
+	arena_lock(&arena_bigmaacs);
+	node* n = heap_find_node(ptr);
+	if (n != NULL && n->in_use == IN_USE) {
+		n->shared = true;
+	} else {
+		n = NULL;
+	}
+	pthread_mutex_unlock(&arena_bigmaacs.lock);
+	if (n == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+// BigMaac export
+// A bigmaac is a range of a file mapped MAP_SHARED, so another process can map it as well instead of getting
+// a copy through a pipe. bigmaac_export() hands out a duplicate of the file descriptor with the range,
+// bigmaac_send() and bigmaac_recv() pass it over a unix socket with SCM_RIGHTS and bigmaac_import() maps it
+// read only or copy on write into the bigmaac arena of the receiver. Exported bigmaacs are not cached when
+// freed or moved into the compressed tier, imports are never punched, resized or grown in place.
+
+int bigmaac_export(void* ptr, struct bigmaac_handle* handle) {
+	if (__atomic_load_n(&load_state, __ATOMIC_ACQUIRE) != LOADED || ptr < base_bigmaac || ptr >= end_bigmaac || handle == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	arena_lock(&arena_bigmaacs);
+	node* const n = heap_find_node(ptr);
+	off_t offset = 0;
+	int fd = n != NULL && n->in_use == IN_USE ? chunk_file(n, &offset) : -1;
+	const size_t length = n == NULL ? 0 : n->size;
+	if (fd >= 0) {
+		fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+		n->exported = fd >= 0;
+	} else {
+		errno = n == NULL || n->in_use != IN_USE ? EINVAL : EOPNOTSUPP;
+	}
+	pthread_mutex_unlock(&arena_bigmaacs.lock);
+	if (fd < 0) {
+		return -1;
+	}
+	tier_begin(ptr, length, true);  // the importers only see what is in the file
+	tier_end();
+	*handle = (struct bigmaac_handle){.fd = fd, .offset = offset, .length = length};
+	return 0;
+}
+
+int bigmaac_send(int socket, const struct bigmaac_handle* handle) {
+	uint64_t range[2] = {handle->offset, handle->length};
+	struct iovec iov = {.iov_base = range, .iov_len = sizeof(range)};
+	union {
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer)};
+	struct cmsghdr* const c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(c), &handle->fd, sizeof(int));
+	ssize_t r;
+	do {
+		r = sendmsg(socket, &msg, MSG_NOSIGNAL);
+	} while (r < 0 && errno == EINTR);
+	return r == (ssize_t)sizeof(range) ? 0 : -1;
+}
+
+int bigmaac_recv(int socket, struct bigmaac_handle* handle) {
+	uint64_t range[2];
+	struct iovec iov = {.iov_base = range, .iov_len = sizeof(range)};
+	union {
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer)};
+	ssize_t r;
+	do {
+		r = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+	} while (r < 0 && errno == EINTR);
+	if (r < 0) {
+		return -1;
+	}
+	const struct cmsghdr* const c = CMSG_FIRSTHDR(&msg);
+	int fd = -1;
+	if (c != NULL && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS && c->cmsg_len == CMSG_LEN(sizeof(int))) {
+		memcpy(&fd, CMSG_DATA(c), sizeof(int));
+	}
+	if (fd < 0 || r != (ssize_t)sizeof(range) || (msg.msg_flags & MSG_CTRUNC) != 0) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		errno = EBADMSG;
+		return -1;
+	}
+	*handle = (struct bigmaac_handle){.fd = fd, .offset = range[0], .length = range[1]};
+	return 0;
+}
+
+void* bigmaac_import(const struct bigmaac_handle* handle, int flags) {
+	if (!init_wait() || handle == NULL || handle->fd < 0 || handle->length == 0 || handle->offset % page_size != 0 ||
+	    (flags != BIGMAAC_IMPORT_READONLY && flags != BIGMAAC_IMPORT_PRIVATE)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	const size_t size = SIZE_TO_MULTIPLE(handle->length, bigmaac_multiple);
+	node* const n = arena_pop(&arena_bigmaacs, size, 0, NULL);
+	if (n == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	n->maps = 0;
+	n->fd = -1;  // the mapping keeps the file open, it is not ours to hand on
+	n->shared = false;
+	n->inherited = false;
+	n->exported = false;
+	const int prot = flags == BIGMAAC_IMPORT_READONLY ? PROT_READ : PROT_READ | PROT_WRITE;
+	const int map = flags == BIGMAAC_IMPORT_READONLY ? MAP_SHARED : MAP_PRIVATE | MAP_NORESERVE;
+	if (mmap(n->ptr, SIZE_TO_MULTIPLE(handle->length, page_size), prot, map | MAP_FIXED, handle->fd, handle->offset) == MAP_FAILED) {
+		const int error = errno;
+		remove_chunk_with_ptr(n->ptr, NULL, 0);
+		errno = error;
+		return NULL;
+	}
+	__atomic_fetch_add(&active_mmaps, 1, __ATOMIC_RELAXED);
+	n->maps = 1;
+	n->inherited = true;
+	return count_alloc(&counters_bigmaacs, handle->length, size, n->ptr);
+}
+
+int bigmaac_checkpoint(void) {
+	if (__atomic_load_n(&load_state, __ATOMIC_ACQUIRE) != LOADED || persist_dir == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	return persist_write(true);
+}
+
+void bigmaac_set_root(void* ptr) { persist_root = ptr; }
+
+void* bigmaac_root(void) {
+	init_wait();
+	return persist_root;
+}
+
+double bigmaac_fragmentation(int which) {
+	if (__atomic_load_n(&load_state, __ATOMIC_ACQUIRE) != LOADED || (which != BIGMAAC_ARENA_FRIES && which != BIGMAAC_ARENA_BIGMAACS)) {
+		return 0.0;
+	}
+
+	// sub-arenas are counted on their own, a free extent can never span two of them
+	size_t free_total = 0;
+	size_t free_largest = 0;
+	const int n = which == BIGMAAC_ARENA_FRIES ? n_fry_arenas : 1;
+	for (int i = 0; i < n; i++) {
+		arena* const a = which == BIGMAAC_ARENA_FRIES ? &arena_fries[i] : &arena_bigmaacs;
+		arena_lock(a);
+		const node* const largest = heap_largest(&a->heap);
+		free_total += (size_t)(a->end - a->base) - a->used;
+		free_largest += largest == NULL ? 0 : largest->size;
+		pthread_mutex_unlock(&a->lock);
+	}
+	return free_total == 0 ? 0.0 : 1.0 - (double)free_largest / (double)free_total;
+}
+
 #ifdef MAIN
 #define T 32
 #define N (4096 * 16)
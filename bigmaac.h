@@ -1,6 +1,23 @@
 #define DEFAULT_MIN_BIGMAAC_SIZE (1024 * 1024 * 300)  // 300MB
 #define DEFAULT_MIN_FRY_SIZE 0                        // disabled
 #define DEFAULT_TEMPLATE "/tmp/bigmaax.XXXXXXXX"
+#define DEFAULT_STRIPE_SIZE 0  // the fries and the store split once over the templates
 #define DEFAULT_MAX_BIGMAAC (1024L * 1024 * 1024 * 512)  // 512GB
 #define DEFAULT_MAX_FRIES (1024L * 1024 * 1024 * 512)    // 512GB
 #define DEFAULT_FRY_SIZE_MULTIPLE 256
+#define DEFAULT_FRY_ARENAS 8
+#define DEFAULT_NUMA 0  // one set of sub-arenas for every node
+#define DEFAULT_TCACHE_MAX_SIZE (1024 * 64)  // 64KB
+#define DEFAULT_FILE_POOL 4
+#define DEFAULT_EXTENT_CACHE 4
+#define DEFAULT_STORE_FILES 0  // a file per bigmaac
+#define DEFAULT_STATS_INTERVAL 0  // no periodic dump
+#define DEFAULT_TRACE_BACKTRACE 0  // no backtraces
+#define DEFAULT_RSS_LIMIT 0        // no limit
+#define DEFAULT_RSS_INTERVAL_MS 100
+#define DEFAULT_IO_DEPTH 64
+#define DEFAULT_COMPRESSED_TIER 0  // no compressed tier
+#define DEFAULT_ADAPTIVE 0         // fixed thresholds
+#define DEFAULT_ADAPTIVE_INTERVAL_MS 1000
+#define DEFAULT_ADAPTIVE_LOW (1024 * 64)                  // 64KB
+#define DEFAULT_ADAPTIVE_HIGH (1024L * 1024 * 1024 * 4)  // 4GB
@@ -0,0 +1,116 @@
+#ifndef _BIGMAAC_API_H
+#define _BIGMAAC_API_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+
+enum bigmaac_advice {
+	BIGMAAC_NORMAL = 0,
+	BIGMAAC_SEQUENTIAL = 1,
+	BIGMAAC_RANDOM = 2,
+	BIGMAAC_WILLNEED = 3,
+	BIGMAAC_DONTNEED = 4,
+	BIGMAAC_COLD = 5,
+	BIGMAAC_PAGEOUT = 6,
+	BIGMAAC_WRITEBACK = 7  // done writing for now, write the range back to the swap partition
+};
+
+// hint how [ptr, ptr + len) of a BigMaac managed allocation is going to be used, len 0 covers the rest of it
+int bigmaac_advise(void* ptr, size_t len, int advice);
+
+enum bigmaac_arena { BIGMAAC_ARENA_FRIES = 0, BIGMAAC_ARENA_BIGMAACS = 1 };
+
+#define BIGMAAC_ALIGN(a) ((int)__builtin_ctzl(a))  // flag for a power of two alignment
+#define BIGMAAC_ALIGN_MASK 0x3f
+enum bigmaac_flags {
+	BIGMAAC_ZERO = 1 << 6,          // zero filled like calloc()
+	BIGMAAC_FORCE_FRY = 1 << 7,      // from the fries whatever the size
+	BIGMAAC_FORCE_BIGMAAC = 1 << 8,  // a bigmaac whatever the size
+	BIGMAAC_FORCE_RAM = 1 << 9,      // from the system allocator, it stays off the swap partition
+	BIGMAAC_FORCE_DISK = 1 << 10     // on the swap partition, a fry up to the bigmaac size and a bigmaac above
+};
+
+// malloc() with BIGMAAC_ALIGN(alignment) and bigmaac_flags, placed like malloc() does without a BIGMAAC_FORCE_
+// flag or when BigMaac is not loaded, free() and realloc() it as usual, realloc() places it like malloc() again
+void* bigmaac_malloc_ex(size_t size, int flags);
+
+// until the matching bigmaac_scope_end() the calling thread's allocations are placed by the BIGMAAC_FORCE_ flag
+// of flags, or by size again for 0, scopes nest up to 64 deep, both return 0 or -1 if there are too many or none
+int bigmaac_scope_begin(int flags);
+int bigmaac_scope_end(void);
+
+// children fork()ed from now on write into the bigmaac at ptr of the calling process instead of a copy of their
+// own, it has to be kept until they are done with it, returns 0 or -1 if ptr is not the start of a bigmaac
+int bigmaac_share(void* ptr);
+
+struct bigmaac_handle {
+	int fd;                     // of the file holding the bigmaac
+	unsigned long long offset;  // of the bigmaac in the file, a multiple of the page size
+	size_t length;
+};
+
+enum bigmaac_import {
+	BIGMAAC_IMPORT_READONLY = 0,  // shows what the exporter writes to it later on
+	BIGMAAC_IMPORT_PRIVATE = 1    // copy on write, pages written by the importer are its own
+};
+
+// a handle another process can map the bigmaac at ptr with instead of copying it, fd is a duplicate the caller
+// closes, the bigmaac has to be kept until the importers are done, returns 0 or -1 if ptr is not the start of
+// a bigmaac (EINVAL) or it has no file of its own to hand out (EOPNOTSUPP)
+int bigmaac_export(void* ptr, struct bigmaac_handle* handle);
+
+// pass a handle over a unix domain socket, the fd with SCM_RIGHTS, both return 0 or -1
+int bigmaac_send(int socket, const struct bigmaac_handle* handle);
+int bigmaac_recv(int socket, struct bigmaac_handle* handle);
+
+// map a handle into the bigmaac arena by bigmaac_import flags, free() it as usual, the fd of the handle can be
+// closed right away, NULL when BigMaac is not loaded or the mapping fails
+void* bigmaac_import(const struct bigmaac_handle* handle, int flags);
+
+// with BIGMAAC_PERSIST write the files back and journal what is allocated, best while nobody writes to it, a
+// restart with the same BIGMAAC_PERSIST gets it back at the same addresses, returns 0 or -1 without
+// BIGMAAC_PERSIST or when writing fails, the journal is also written at exit
+int bigmaac_checkpoint(void);
+
+// the pointer a restarted process finds its data through, kept in the journal, NULL when nothing was restored
+void bigmaac_set_root(void* ptr);
+void* bigmaac_root(void);
+
+// share of the free space of an arena outside of its largest free extent, 0 when nothing is fragmented
+double bigmaac_fragmentation(int arena);
+
+struct bigmaac_arena_stats {
+	unsigned long long allocs;           // since start up
+	unsigned long long frees;            // since start up
+	unsigned long long bytes_requested;  // asked for by the callers since start up
+	unsigned long long bytes_allocated;  // handed out after rounding up since start up
+	size_t bytes_reserved;               // address space of the arena
+	size_t bytes_used;                   // in chunks handed out right now, cached ones included
+	size_t bytes_resident;               // of bytes_used in RAM
+	size_t bytes_swapped;                // of bytes_used on disk or never touched
+	size_t free_extents;
+	size_t largest_free_extent;
+	unsigned long long lock_wait_ns;  // time threads spent waiting for the arena locks
+};
+
+struct bigmaac_stats {
+	struct bigmaac_arena_stats fries;
+	struct bigmaac_arena_stats bigmaacs;
+	int active_mmaps;   // mappings made by BigMaac
+	int process_mmaps;  // mappings of the whole process, what vm.max_map_count limits, -1 if unknown
+	unsigned long long realloc_bytes_copied;
+	size_t compressed_bytes;   // of bigmaacs held compressed in RAM by BIGMAAC_COMPRESSED_TIER
+	size_t compressed_stored;  // what compressed_bytes take up
+};
+
+// fill in stats, returns 0 or -1 when BigMaac is not loaded
+int bigmaac_stats(struct bigmaac_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* bigmaac_api.h */
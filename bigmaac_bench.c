@@ -0,0 +1,317 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(NOTCOMPAT)
+#include "mmap_malloc.h"
+#define PREFIX(x) mmap_##x
+#else
+#define PREFIX(x) x
+#endif
+
+// Allocator benchmark, run as is for the system allocator, with LD_PRELOAD for bigmaac.so or built with
+// -DNOTCOMPAT against bigmaac.c. Every workload runs with 1, 2, 4, ... threads up to -t, each thread
+// doing the same number of operations. Results go to stdout as CSV, one line per workload, thread count
+// and entry point, with ops/sec and latency percentiles from a log-linear histogram of every call.
+
+#define SUB_BUCKETS 16  // per power of two, percentiles are within 1/16th
+#define BUCKETS (64 * SUB_BUCKETS)
+#define SLOTS 1024  // live allocations per thread
+#define BATCH 64    // passthrough calls timed together, each one takes about as long as reading the clock
+
+enum entry { ENTRY_MALLOC = 0, ENTRY_CALLOC = 1, ENTRY_REALLOC = 2, ENTRY_FREE = 3, ENTRIES = 4 };
+static const char* entry_names[ENTRIES] = {"malloc", "calloc", "realloc", "free"};
+
+typedef struct histogram {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t buckets[BUCKETS];
+} histogram;
+
+typedef struct worker {
+	pthread_t thread;
+	int workload;
+	uint64_t ops;
+	uint64_t seed;
+	histogram hist[ENTRIES];
+} worker;
+
+typedef struct workload {
+	const char* name;
+	uint64_t ops;  // per thread
+	void (*run)(worker* const w);
+} workload;
+
+static int bucket_of(const uint64_t ns) {
+	if (ns < SUB_BUCKETS) {
+		return ns;
+	}
+	const int msb = 63 - __builtin_clzll(ns);
+	return (msb - 3) * SUB_BUCKETS + ((ns >> (msb - 4)) & (SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_value(const int bucket) {
+	if (bucket < SUB_BUCKETS) {
+		return bucket;
+	}
+	const int msb = bucket / SUB_BUCKETS + 3;
+	return (1ull << msb) | ((uint64_t)(bucket % SUB_BUCKETS) << (msb - 4));
+}
+
+static uint64_t percentile(const histogram* const h, const double p) {
+	const uint64_t rank = h->count * p;
+	uint64_t seen = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen > rank) {
+			return bucket_value(i);
+		}
+	}
+	return 0;
+}
+
+static inline uint64_t now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static inline void record(worker* const w, const int entry, const uint64_t start) {
+	const uint64_t ns = now_ns() - start;
+	histogram* const h = &w->hist[entry];
+	h->count++;
+	h->total_ns += ns;
+	h->buckets[bucket_of(ns)]++;
+}
+
+static inline void record_batch(worker* const w, const int entry, const uint64_t start, const int n) {
+	const uint64_t ns = now_ns() - start;
+	histogram* const h = &w->hist[entry];
+	h->count += n;
+	h->total_ns += ns;
+	h->buckets[bucket_of(ns / n)] += n;
+}
+
+static inline uint64_t next_random(worker* const w) {  // xorshift64
+	w->seed ^= w->seed << 13;
+	w->seed ^= w->seed >> 7;
+	w->seed ^= w->seed << 17;
+	return w->seed;
+}
+
+static inline size_t random_size(worker* const w, const size_t min, const size_t max) { return min + next_random(w) % (max - min + 1); }
+
+static void* timed_malloc(worker* const w, const size_t size) {
+	const uint64_t start = now_ns();
+	void* const p = PREFIX(malloc)(size);
+	record(w, ENTRY_MALLOC, start);
+	if (p != NULL) {
+		*(char*)p = 1;  // touch it like a real program would
+	}
+	return p;
+}
+
+static void* timed_calloc(worker* const w, const size_t size) {
+	const uint64_t start = now_ns();
+	void* const p = PREFIX(calloc)(1, size);
+	record(w, ENTRY_CALLOC, start);
+	return p;
+}
+
+static void* timed_realloc(worker* const w, void* const ptr, const size_t size) {
+	const uint64_t start = now_ns();
+	void* const p = PREFIX(realloc)(ptr, size);
+	record(w, ENTRY_REALLOC, start);
+	if (p != NULL) {
+		((char*)p)[size - 1] = 1;
+	}
+	return p;
+}
+
+static void timed_free(worker* const w, void* const ptr) {
+	const uint64_t start = now_ns();
+	PREFIX(free)(ptr);
+	record(w, ENTRY_FREE, start);
+}
+
+// replace random live allocations with new ones of random size
+static void churn(worker* const w, const size_t min, const size_t max, const int slots) {
+	void* live[SLOTS] = {NULL};
+	for (uint64_t i = 0; i < w->ops; i++) {
+		const int slot = next_random(w) % slots;
+		if (live[slot] != NULL) {
+			timed_free(w, live[slot]);
+		}
+		live[slot] = timed_malloc(w, random_size(w, min, max));
+	}
+	for (int i = 0; i < slots; i++) {
+		if (live[i] != NULL) {
+			timed_free(w, live[i]);
+		}
+	}
+}
+
+// small allocations BigMaac hands straight to the system allocator, what it costs on top of it, the
+// percentiles are of the average call in batches of BATCH
+static void run_passthrough(worker* const w) {
+	void* live[BATCH];
+	size_t sizes[BATCH];
+	for (uint64_t i = 0; i < w->ops; i += BATCH) {
+		for (int j = 0; j < BATCH; j++) {
+			sizes[j] = random_size(w, 16, 512);
+		}
+		uint64_t start = now_ns();
+		for (int j = 0; j < BATCH; j++) {
+			live[j] = PREFIX(malloc)(sizes[j]);
+		}
+		record_batch(w, ENTRY_MALLOC, start, BATCH);
+		start = now_ns();
+		for (int j = 0; j < BATCH; j++) {
+			PREFIX(free)(live[j]);
+		}
+		record_batch(w, ENTRY_FREE, start, BATCH);
+	}
+}
+
+static void run_fries(worker* const w) { churn(w, 1024, 1024 * 64, SLOTS); }
+
+static void run_bigmaacs(worker* const w) { churn(w, 1024 * 1024 * 4, 1024 * 1024 * 64, 16); }
+
+// grow buffers by half their size up to 256MB, the way vectors and string builders do
+static void run_realloc(worker* const w) {
+	for (uint64_t i = 0; i < w->ops;) {
+		void* p = NULL;
+		for (size_t size = 1024; size <= 1024 * 1024 * 256 && i < w->ops; size += size / 2, i++) {
+			void* const q = timed_realloc(w, p, size);
+			if (q == NULL) {
+				break;
+			}
+			p = q;
+		}
+		timed_free(w, p);
+	}
+}
+
+// mostly small objects, some medium buffers and the odd large array, a bit like a Python process
+static void run_mixed(worker* const w) {
+	void* live[SLOTS] = {NULL};
+	for (uint64_t i = 0; i < w->ops; i++) {
+		const int slot = next_random(w) % SLOTS;
+		if (live[slot] != NULL) {
+			timed_free(w, live[slot]);
+		}
+		const int kind = next_random(w) % 1000;
+		if (kind < 900) {
+			live[slot] = timed_malloc(w, random_size(w, 16, 512));
+		} else if (kind < 990) {
+			live[slot] = timed_calloc(w, random_size(w, 512, 1024 * 64));
+		} else if (kind < 999) {
+			live[slot] = timed_malloc(w, random_size(w, 1024 * 1024, 1024 * 1024 * 16));
+		} else {
+			live[slot] = timed_realloc(w, NULL, 1024);
+			for (size_t size = 2048; size <= 1024 * 1024 * 8 && live[slot] != NULL; size *= 2) {
+				live[slot] = timed_realloc(w, live[slot], size);
+			}
+		}
+	}
+	for (int i = 0; i < SLOTS; i++) {
+		if (live[i] != NULL) {
+			timed_free(w, live[i]);
+		}
+	}
+}
+
+static workload workloads[] = {
+    {"passthrough", 2000000, run_passthrough},
+    {"fries", 200000, run_fries},
+    {"bigmaacs", 2000, run_bigmaacs},
+    {"realloc", 2000, run_realloc},
+    {"mixed", 200000, run_mixed},
+};
+#define WORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+static void* worker_main(void* const arg) {
+	worker* const w = (worker*)arg;
+	workloads[w->workload].run(w);
+	return NULL;
+}
+
+int main(int argc, char* argv[]) {
+	const char* label = "system";
+	const char* only = NULL;
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t ops = 0;
+	for (int opt; (opt = getopt(argc, argv, "l:w:t:n:h")) != -1;) {
+		switch (opt) {
+			case 'l':
+				label = optarg;
+				break;
+			case 'w':
+				only = optarg;
+				break;
+			case 't':
+				max_threads = atoi(optarg);
+				break;
+			case 'n':
+				ops = strtoull(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stdout, "%s [-l label] [-w passthrough|fries|bigmaacs|realloc|mixed] [-t max threads] [-n ops per thread]\n", argv[0]);
+				return 0;
+		}
+	}
+	max_threads = max_threads < 1 ? 1 : max_threads;
+
+	worker* const workers = (worker*)PREFIX(calloc)(max_threads, sizeof(worker));
+	if (workers == NULL) {
+		fprintf(stderr, "Failed to allocate workers\n");
+		return 1;
+	}
+
+	fprintf(stdout, "# label,workload,threads,entry,calls,ops_per_sec,avg_ns,p50_ns,p99_ns,p999_ns\n");
+	for (int wl = 0; wl < WORKLOADS; wl++) {
+		if (only != NULL && strcmp(only, workloads[wl].name) != 0) {
+			continue;
+		}
+		for (int threads = 1, last = 0; !last; threads *= 2) {
+			if (threads >= max_threads) {  // always end with max_threads
+				threads = max_threads;
+				last = 1;
+			}
+			const uint64_t start = now_ns();
+			for (int t = 0; t < threads; t++) {
+				workers[t] = (worker){.workload = wl, .ops = ops > 0 ? ops : workloads[wl].ops, .seed = 0x9E3779B97F4A7C15ull * (t + 1)};
+				pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+			}
+			for (int t = 0; t < threads; t++) {
+				pthread_join(workers[t].thread, NULL);
+			}
+			const double seconds = (now_ns() - start) / 1e9;
+
+			for (int e = 0; e < ENTRIES; e++) {
+				histogram h = {0};
+				for (int t = 0; t < threads; t++) {
+					h.count += workers[t].hist[e].count;
+					h.total_ns += workers[t].hist[e].total_ns;
+					for (int b = 0; b < BUCKETS; b++) {
+						h.buckets[b] += workers[t].hist[e].buckets[b];
+					}
+				}
+				if (h.count == 0) {
+					continue;
+				}
+				fprintf(stdout, "%s,%s,%d,%s,%llu,%.0f,%.0f,%llu,%llu,%llu\n", label, workloads[wl].name, threads, entry_names[e], (unsigned long long)h.count,
+				        h.count / seconds, (double)h.total_ns / h.count, (unsigned long long)percentile(&h, 0.5), (unsigned long long)percentile(&h, 0.99),
+				        (unsigned long long)percentile(&h, 0.999));
+			}
+			fflush(stdout);
+		}
+	}
+
+	PREFIX(free)(workers);
+	return 0;
+}
@@ -0,0 +1,169 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bigmaac_trace.h"
+
+// Summarize a BIGMAAC_TRACE file: totals per operation, allocations by power of two size class, which
+// helps picking BIGMAAC_MIN_FRY_SIZE and BIGMAAC_MIN_BIGMAAC_SIZE, and the call sites of the sampled
+// allocations ordered by the bytes they sent to BigMaac.
+
+#define SIZE_CLASSES 64
+#define MB (1024.0 * 1024.0)
+
+typedef struct site {
+	uint64_t frame;
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t latency_ns;
+} site;
+
+static const char* op_names[] = {"malloc", "calloc", "realloc", "memalign", "free"};
+
+static char* maps = NULL;  // the last copy of /proc/self/maps in the trace
+static size_t maps_length = 0;
+
+// file and offset of addr, from the maps of the traced process
+static void print_location(const uint64_t addr) {
+	for (char* line = maps; line != NULL && line < maps + maps_length;) {
+		char* const end = memchr(line, '\n', maps + maps_length - line);
+		uint64_t start, stop, offset;
+		int path = 0;
+		if (sscanf(line, "%" SCNx64 "-%" SCNx64 " %*s %" SCNx64 " %*s %*s %n", &start, &stop, &offset, &path) == 3 && start <= addr && addr < stop) {
+			const int length = (end == NULL ? maps + maps_length : end) - line - path;
+			printf("%.*s+0x%" PRIx64 "\n", length, line + path, addr - start + offset);
+			return;
+		}
+		line = end == NULL ? NULL : end + 1;
+	}
+	printf("0x%" PRIx64 "\n", addr);
+}
+
+static int by_bytes(const void* a, const void* b) {
+	const uint64_t x = ((const site*)a)->bytes, y = ((const site*)b)->bytes;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		fprintf(stdout, "%s TRACE [top call sites]\n", argv[0]);
+		return 0;
+	}
+	const int top = argc > 2 ? atoi(argv[2]) : 20;
+
+	FILE* const f = fopen(argv[1], "rb");
+	char magic[sizeof(TRACE_MAGIC) - 1];
+	if (f == NULL || fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+		fprintf(stderr, "%s is not a BigMaac trace\n", argv[1]);
+		return 1;
+	}
+
+	uint64_t op_count[5] = {0}, op_bytes[5] = {0}, op_latency[5] = {0}, op_latency_max[5] = {0};
+	uint64_t class_count[2][SIZE_CLASSES] = {{0}}, class_bytes[2][SIZE_CLASSES] = {{0}};
+	uint64_t dropped = 0, events = 0, sampled = 0;
+	size_t n_sites = 0, sites_length = 1024;
+	site* sites = calloc(sites_length, sizeof(site));  // open addressing on frame
+
+	trace_block block;
+	while (fread(&block, sizeof(block), 1, f) == 1) {
+		char* const data = malloc(block.length + 1);
+		if (data == NULL || (block.length > 0 && fread(data, block.length, 1, f) != 1)) {
+			fprintf(stderr, "%s is cut short\n", argv[1]);
+			free(data);
+			break;
+		}
+		if (block.kind == TRACE_MAPS_START) {
+			maps_length = 0;
+		} else if (block.kind == TRACE_MAPS) {
+			maps = realloc(maps, maps_length + block.length);
+			memcpy(maps + maps_length, data, block.length);
+			maps_length += block.length;
+		} else if (block.kind == TRACE_DROPPED) {
+			dropped += *(uint64_t*)data;
+		} else if (block.kind == TRACE_EVENTS) {
+			for (const trace_event* e = (trace_event*)data; (char*)(e + 1) <= data + block.length; e++) {
+				events++;
+				const int op = e->op < 5 ? e->op : TRACE_FREE;
+				op_count[op]++;
+				op_bytes[op] += e->size;
+				op_latency[op] += e->latency_ns;
+				op_latency_max[op] = e->latency_ns > op_latency_max[op] ? e->latency_ns : op_latency_max[op];
+				if (op == TRACE_FREE) {
+					continue;
+				}
+				const int c = e->size == 0 ? 0 : 64 - __builtin_clzll(e->size);
+				class_count[e->arena & 1][c]++;
+				class_bytes[e->arena & 1][c] += e->size;
+				if (e->frames == 0) {
+					continue;
+				}
+				sampled++;
+				if (n_sites * 2 >= sites_length) {  // keep the table at most half full
+					site* const grown = calloc(sites_length * 2, sizeof(site));
+					for (size_t i = 0; i < sites_length; i++) {
+						if (sites[i].count > 0) {
+							size_t j = sites[i].frame % (sites_length * 2);
+							while (grown[j].count > 0) {
+								j = (j + 1) % (sites_length * 2);
+							}
+							grown[j] = sites[i];
+						}
+					}
+					free(sites);
+					sites = grown;
+					sites_length *= 2;
+				}
+				size_t i = e->frame[0] % sites_length;
+				while (sites[i].count > 0 && sites[i].frame != e->frame[0]) {
+					i = (i + 1) % sites_length;
+				}
+				n_sites += sites[i].count == 0;
+				sites[i].frame = e->frame[0];
+				sites[i].count++;
+				sites[i].bytes += e->size;
+				sites[i].latency_ns += e->latency_ns;
+			}
+		}
+		free(data);
+	}
+	fclose(f);
+
+	printf("%" PRIu64 " events, %" PRIu64 " dropped, %" PRIu64 " with a backtrace\n\n", events, dropped, sampled);
+	printf("%-10s %12s %14s %14s %14s\n", "operation", "count", "MB", "avg us", "max us");
+	for (int op = 0; op < 5; op++) {
+		if (op_count[op] > 0) {
+			printf("%-10s %12" PRIu64 " %14.2f %14.2f %14.2f\n", op_names[op], op_count[op], op_bytes[op] / MB, op_latency[op] / 1e3 / op_count[op],
+			       op_latency_max[op] / 1e3);
+		}
+	}
+
+	printf("\n%-22s %12s %14s %12s %14s\n", "size class", "fries", "fries MB", "bigmaacs", "bigmaacs MB");
+	for (int c = 0; c < SIZE_CLASSES; c++) {
+		if (class_count[0][c] + class_count[1][c] > 0) {
+			char range[48];  // two 20 digit numbers and the brackets
+			snprintf(range, sizeof(range), "(%llu, %llu]", c == 0 ? 0ull : (1ull << (c - 1)) - 1, c == 0 ? 0ull : (1ull << c) - 1);
+			printf("%-22s %12" PRIu64 " %14.2f %12" PRIu64 " %14.2f\n", range, class_count[0][c], class_bytes[0][c] / MB, class_count[1][c],
+			       class_bytes[1][c] / MB);
+		}
+	}
+
+	if (n_sites > 0) {
+		size_t n = 0;
+		for (size_t i = 0; i < sites_length; i++) {
+			if (sites[i].count > 0) {
+				sites[n++] = sites[i];
+			}
+		}
+		qsort(sites, n, sizeof(site), by_bytes);
+		printf("\n%12s %14s %10s  %s\n", "sampled", "MB", "avg us", "call site");
+		for (size_t i = 0; i < n && i < (size_t)top; i++) {
+			printf("%12" PRIu64 " %14.2f %10.2f  ", sites[i].count, sites[i].bytes / MB, sites[i].latency_ns / 1e3 / sites[i].count);
+			print_location(sites[i].frame);
+		}
+	}
+
+	free(sites);
+	free(maps);
+	return 0;
+}
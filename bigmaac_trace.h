@@ -0,0 +1,36 @@
+#ifndef _BIGMAAC_TRACE_H
+#define _BIGMAAC_TRACE_H 1
+
+#include <stdint.h>
+
+// BIGMAAC_TRACE files start with TRACE_MAGIC followed by blocks, each a trace_block header and length bytes
+#define TRACE_MAGIC "BMTRACE1"
+#define TRACE_FRAMES 8
+
+enum trace_op { TRACE_MALLOC = 0, TRACE_CALLOC = 1, TRACE_REALLOC = 2, TRACE_MEMALIGN = 3, TRACE_FREE = 4 };
+enum trace_kind {
+	TRACE_EVENTS = 1,      // an array of trace_event
+	TRACE_MAPS_START = 2,  // empty, the TRACE_MAPS blocks after it are a new copy of /proc/self/maps
+	TRACE_MAPS = 3,        // a piece of /proc/self/maps
+	TRACE_DROPPED = 4      // an uint64_t, events lost to full ring buffers since the last one
+};
+
+typedef struct trace_block {
+	uint32_t kind;
+	uint32_t length;
+} trace_block;
+
+typedef struct trace_event {
+	uint64_t time_ns;  // CLOCK_MONOTONIC
+	uint64_t ptr;
+	uint64_t size;  // requested, or of the chunk for TRACE_FREE
+	uint32_t latency_ns;
+	uint32_t tid;
+	uint8_t op;
+	uint8_t arena;   // 0 fries, 1 bigmaacs
+	uint8_t frames;  // number of valid entries in frame, 0 unless this event was sampled
+	uint8_t pad[5];
+	uint64_t frame[TRACE_FRAMES];  // return addresses, the caller of the allocation function first
+} trace_event;
+
+#endif /* bigmaac_trace.h */
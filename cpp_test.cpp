@@ -12,5 +12,15 @@ int main() {
     for (size_t i = vec.size(); i-- > 0;)
         std::cout << vec[i] << ' ';
     std::cout << std::endl;
+
+    galaxy::bigmaac_resource fries(BIGMAAC_FORCE_FRY);
+    std::pmr::vector<int> pmr_vec(16, &fries);
+    for (size_t i = 0; i < pmr_vec.size(); i++)
+        pmr_vec[i] = static_cast<int>(i);
+
+    galaxy::big_vector<int> big;
+    for (int i = 0; i < 1024 * 1024; i++)
+        big.push_back(i);
+    std::cout << big.size() << ' ' << big[big.size() - 1] << ' ' << pmr_vec[15] << std::endl;
     return 0;
 }
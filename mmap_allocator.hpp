@@ -3,11 +3,18 @@
 
 // g++ -std=gnu++20
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
 #include <new>
+#include <stdexcept>
 #include <type_traits>
+#include <utility>
 
+#include "bigmaac_api.h"
 #include "mmap_malloc.h"
 
 namespace galaxy {
@@ -66,6 +73,164 @@ class mmap_allocator {
 	}
 };
 
+// std::pmr::memory_resource on BigMaac, every allocation goes to the arena picked by flags (0 to place it by
+// size, BIGMAAC_FORCE_FRY or BIGMAAC_FORCE_BIGMAAC) and gets the hint advice from bigmaac_advice
+class bigmaac_resource : public std::pmr::memory_resource {
+   public:
+	explicit bigmaac_resource(int flags = 0, int advice = BIGMAAC_NORMAL) noexcept : _M_flags(flags), _M_advice(advice) {}
+
+	int flags() const noexcept { return _M_flags; }
+	int advice() const noexcept { return _M_advice; }
+
+   private:
+	void* do_allocate(std::size_t __bytes, std::size_t __alignment) override {
+		void* __ret = bigmaac_malloc_ex(__bytes, _M_flags | BIGMAAC_ALIGN(__alignment));
+		if (!__ret) throw std::bad_alloc();
+		if (_M_advice != BIGMAAC_NORMAL) bigmaac_advise(__ret, __bytes, _M_advice);  // fails harmlessly for memory BigMaac does not manage
+		return __ret;
+	}
+
+	// BigMaac finds the chunk by its address, the size and alignment are not needed to give it back
+	void do_deallocate(void* __p, std::size_t, std::size_t) override { mmap_free(__p); }
+
+	// all of them share the one heap, memory from any can go back through any other
+	bool do_is_equal(const std::pmr::memory_resource& __other) const noexcept override {
+		return dynamic_cast<const bigmaac_resource*>(&__other) != nullptr;
+	}
+
+	int _M_flags;
+	int _M_advice;
+};
+
+// a vector of trivially copyable elements kept in one mmap_malloc() buffer, growing with mmap_realloc() so a
+// bigmaac is extended in place or remapped instead of having its elements copied over
+template <typename _Tp>
+class big_vector {
+	static_assert(std::is_trivially_copyable_v<_Tp>, "big_vector elements are moved with realloc");
+
+   public:
+	using value_type = _Tp;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using reference = _Tp&;
+	using const_reference = const _Tp&;
+	using pointer = _Tp*;
+	using const_pointer = const _Tp*;
+	using iterator = _Tp*;
+	using const_iterator = const _Tp*;
+
+	big_vector() noexcept = default;
+	explicit big_vector(size_type __n) { resize(__n); }
+	big_vector(size_type __n, const _Tp& __value) { resize(__n, __value); }
+	big_vector(const big_vector& __other) {
+		if (__other._M_size == 0) return;
+		_M_realloc(__other._M_size);
+		std::memcpy(_M_data, __other._M_data, __other._M_size * sizeof(_Tp));
+		_M_size = __other._M_size;
+	}
+	big_vector(big_vector&& __other) noexcept { swap(__other); }
+	~big_vector() { mmap_free(_M_data); }
+
+	big_vector& operator=(const big_vector& __other) {
+		if (this != &__other) {
+			big_vector __copy(__other);
+			swap(__copy);
+		}
+		return *this;
+	}
+	big_vector& operator=(big_vector&& __other) noexcept {
+		big_vector __moved(std::move(__other));
+		swap(__moved);
+		return *this;
+	}
+
+	size_type size() const noexcept { return _M_size; }
+	size_type capacity() const noexcept { return _M_capacity; }
+	bool empty() const noexcept { return _M_size == 0; }
+	constexpr size_type max_size() const noexcept { return std::size_t(__PTRDIFF_MAX__) / sizeof(_Tp); }
+
+	_Tp* data() noexcept { return _M_data; }
+	const _Tp* data() const noexcept { return _M_data; }
+	_Tp& operator[](size_type __i) noexcept { return _M_data[__i]; }
+	const _Tp& operator[](size_type __i) const noexcept { return _M_data[__i]; }
+	_Tp& front() noexcept { return _M_data[0]; }
+	_Tp& back() noexcept { return _M_data[_M_size - 1]; }
+	iterator begin() noexcept { return _M_data; }
+	iterator end() noexcept { return _M_data + _M_size; }
+	const_iterator begin() const noexcept { return _M_data; }
+	const_iterator end() const noexcept { return _M_data + _M_size; }
+
+	void reserve(size_type __n) {
+		if (__n > _M_capacity) _M_realloc(__n);
+	}
+
+	void resize(size_type __n) {
+		reserve(__n);
+		if (__n > _M_size) std::uninitialized_value_construct_n(_M_data + _M_size, __n - _M_size);
+		_M_size = __n;
+	}
+
+	void resize(size_type __n, const _Tp& __value) {
+		reserve(__n);
+		if (__n > _M_size) std::uninitialized_fill_n(_M_data + _M_size, __n - _M_size, __value);
+		_M_size = __n;
+	}
+
+	void push_back(const _Tp& __value) {
+		if (_M_size == _M_capacity) {
+			const _Tp __copy = __value;  // may live in the buffer about to move
+			_M_grow();
+			_M_data[_M_size++] = __copy;
+			return;
+		}
+		_M_data[_M_size++] = __value;
+	}
+
+	template <typename... _Args>
+	_Tp& emplace_back(_Args&&... __args) {
+		if (_M_size == _M_capacity) _M_grow();
+		return *::new (static_cast<void*>(_M_data + _M_size++)) _Tp(std::forward<_Args>(__args)...);
+	}
+
+	void pop_back() noexcept { _M_size--; }
+	void clear() noexcept { _M_size = 0; }
+
+	// realloc() down to size, a bigmaac hands the pages it no longer needs back to the disk
+	void shrink_to_fit() {
+		if (_M_size == 0) {
+			mmap_free(_M_data);
+			_M_data = nullptr;
+			_M_capacity = 0;
+		} else if (_M_size < _M_capacity) {
+			_M_realloc(_M_size);
+		}
+	}
+
+	void swap(big_vector& __other) noexcept {
+		std::swap(_M_data, __other._M_data);
+		std::swap(_M_size, __other._M_size);
+		std::swap(_M_capacity, __other._M_capacity);
+	}
+
+   private:
+	void _M_grow() {
+		if (_M_capacity == max_size()) throw std::length_error("big_vector");
+		_M_realloc(_M_capacity < 8 ? 8 : _M_capacity > max_size() / 2 ? max_size() : _M_capacity * 2);
+	}
+
+	void _M_realloc(size_type __n) {
+		if (__n > max_size()) throw std::length_error("big_vector");
+		_Tp* __ret = static_cast<_Tp*>(mmap_realloc(static_cast<void*>(_M_data), __n * sizeof(_Tp)));
+		if (!__ret) throw std::bad_alloc();
+		_M_data = __ret;
+		_M_capacity = __n;
+	}
+
+	_Tp* _M_data = nullptr;
+	size_type _M_size = 0;
+	size_type _M_capacity = 0;
+};
+
 }  // namespace galaxy
 
 #endif
@@ -11,7 +11,13 @@ void* mmap_malloc(size_t size);
 void* mmap_calloc(size_t count, size_t size);
 void* mmap_realloc(void* ptr, size_t size);
 void* mmap_reallocarray(void* ptr, size_t size, size_t count);
+int mmap_posix_memalign(void** memptr, size_t alignment, size_t size);
+void* mmap_aligned_alloc(size_t alignment, size_t size);
+void* mmap_memalign(size_t alignment, size_t size);
+void* mmap_valloc(size_t size);
+void* mmap_pvalloc(size_t size);
 void mmap_free(void* ptr);
+size_t mmap_malloc_usable_size(void* ptr);
 
 #ifdef __cplusplus
 }
@@ -1,9 +1,23 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/personality.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "bigmaac.h"
+#include "bigmaac_api.h"
 
 #define N 20
+#define BIG (DEFAULT_MIN_BIGMAAC_SIZE + 4096 * 3)  // a bigmaac with the default thresholds
+#define FRY (1024 * 1024)  // bigger than the holes left early on, so it comes from the free rest of its arena
+#define PAGE 4096
 
 int seed = 0xbeef;
 
@@ -15,7 +29,321 @@ int checksum(int* p, size_t n) {
 	return c;
 }
 
-int main() {
+// the BigMaac API when preloaded, these checks need it
+#define API(name) __typeof__(&name) api_##name = (__typeof__(&name))dlsym(RTLD_DEFAULT, #name)
+
+#define CHECK(cond)                                                                \
+	if (!(cond)) {                                                             \
+		fprintf(stderr, "%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); \
+		exit(1);                                                           \
+	}
+
+// one int per page, enough to tell the data apart without touching all of it
+void fill(char* p, size_t size, int tag) {
+	for (size_t i = 0; i + sizeof(int) <= size; i += PAGE) {
+		*(int*)(p + i) = tag + (int)(i / PAGE);
+	}
+}
+
+int filled(const char* p, size_t size, int tag) {
+	for (size_t i = 0; i + sizeof(int) <= size; i += PAGE) {
+		if (*(const int*)(p + i) != tag + (int)(i / PAGE)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// BigMaac chunks live in mappings of its backing files, the system allocator's in anonymous memory
+int bigmaac_mapped(const void* p) {
+	FILE* maps = fopen("/proc/self/maps", "r");
+	if (maps == NULL) {
+		return 0;
+	}
+	char line[4096];
+	int found = 0;
+	while (fgets(line, sizeof(line), maps) != NULL) {
+		unsigned long start, end;
+		int path = 0;
+		if (sscanf(line, "%lx-%lx %*s %*s %*s %*s %n", &start, &end, &path) == 2 && (uintptr_t)p >= start && (uintptr_t)p < end) {
+			found = path > 0 && line[path] == '/';
+			break;
+		}
+	}
+	fclose(maps);
+	return found;
+}
+
+void test_realloc(void) {
+	fprintf(stderr, "Realloc in place\n");
+	const size_t sizes[2] = {FRY, BIG};
+	for (int i = 0; i < 2; i++) {
+		char* p = malloc(sizes[i]);
+		CHECK(p != NULL);
+		const int managed = bigmaac_mapped(p);  // fries may be off
+		fill(p, sizes[i], 7);
+		char* grown = realloc(p, sizes[i] * 2);  // the arena is still empty behind it
+		CHECK(grown != NULL && filled(grown, sizes[i], 7));
+		CHECK(!managed || grown == p);
+		fill(grown, sizes[i] * 2, 9);
+		char* shrunk = realloc(grown, sizes[i] / 2);
+		CHECK(shrunk != NULL && filled(shrunk, sizes[i] / 2, 9));
+		CHECK(!managed || shrunk == grown);
+		free(shrunk);
+	}
+}
+
+void test_calloc(void) {
+	fprintf(stderr, "Calloc\n");
+	const size_t sizes[2] = {FRY, BIG};
+	for (int i = 0; i < 2; i++) {  // where dirty memory was just freed
+		char* p = malloc(sizes[i]);
+		CHECK(p != NULL);
+		fill(p, sizes[i], 3);
+		free(p);
+		p = calloc(1, sizes[i]);
+		CHECK(p != NULL);
+		for (size_t k = 0; k < sizes[i]; k += PAGE / 4) {
+			CHECK(p[k] == 0);
+		}
+		CHECK(p[sizes[i] - 1] == 0);
+		free(p);
+	}
+	volatile size_t count = SIZE_MAX / 2;  // not known to the compiler, which would warn
+	errno = 0;
+	void* p = calloc(count, 4);
+	CHECK(p == NULL && errno == ENOMEM);
+}
+
+void test_aligned(void) {
+	fprintf(stderr, "Aligned\n");
+	const size_t alignments[3] = {64, PAGE, 1024 * 1024 * 2};
+	const size_t sizes[3] = {1000, FRY, BIG};
+	for (int a = 0; a < 3; a++) {
+		for (int s = 0; s < 3; s++) {
+			void* p[3] = {NULL, aligned_alloc(alignments[a], sizes[s]), memalign(alignments[a], sizes[s])};
+			CHECK(posix_memalign(&p[0], alignments[a], sizes[s]) == 0);
+			for (int k = 0; k < 3; k++) {
+				CHECK(p[k] != NULL && (uintptr_t)p[k] % alignments[a] == 0);
+				memset(p[k], k, 64);
+				((char*)p[k])[sizes[s] - 1] = k;
+				free(p[k]);
+			}
+		}
+	}
+}
+
+// run self with argv[1] stage and the NULL terminated NAME=value list env added, it has to exit with 0
+void run_stage(const char* self, const char* stage, const char* arg, char** env, int no_aslr) {
+	const pid_t pid = fork();
+	CHECK(pid >= 0);
+	if (pid == 0) {
+		for (; *env != NULL; env++) {
+			putenv(*env);
+		}
+		if (no_aslr) {
+			personality(ADDR_NO_RANDOMIZE);
+		}
+		execl(self, self, stage, arg, (char*)NULL);
+		_exit(1);
+	}
+	int status;
+	CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// a fry freed twice into the thread cache is turned down the second time, and not handed out twice
+int tcache_stage(void) {
+	char* p = malloc(PAGE * 4);
+	char* volatile freed = p;  // not known to the compiler, which would warn about the use after free
+	free(p);
+	free(freed);
+	if (malloc_usable_size(freed) != 0) {
+		return 1;
+	}
+	char* a = malloc(PAGE * 4);
+	char* b = malloc(PAGE * 4);
+	return a != NULL && a != b ? 0 : 1;
+}
+
+void test_tcache(const char* self) {
+	fprintf(stderr, "Double free\n");
+	char* env[] = {"BIGMAAC_MIN_FRY_SIZE=1024", NULL};
+	run_stage(self, "tcache", NULL, env, 0);
+}
+
+// with a low enough rss limit the pages of fries and bigmaacs go to the compressed tier or out to the files
+int tier_stage(void) {
+	API(bigmaac_stats);
+	char* fries[64];
+	for (int i = 0; i < 64; i++) {
+		fries[i] = malloc(FRY);
+		fill(fries[i], FRY, i * 1000);
+	}
+	char* big = malloc(BIG);
+	fill(big, BIG, 11);
+	struct bigmaac_stats stats;
+	for (int i = 0; i < 100 && api_bigmaac_stats(&stats) == 0 && stats.compressed_bytes == 0; i++) {
+		usleep(1000 * 20);
+	}
+	for (int i = 0; i < 64; i++) {
+		if (!filled(fries[i], FRY, i * 1000)) {
+			return 1;
+		}
+	}
+	return filled(big, BIG, 11) ? 0 : 1;
+}
+
+void test_tier(const char* self) {
+	fprintf(stderr, "Compressed tier\n");
+	char* env[] = {"BIGMAAC_COMPRESSED_TIER=268435456", "BIGMAAC_RSS_LIMIT=67108864", "BIGMAAC_RSS_INTERVAL=10",
+	               "BIGMAAC_BACKING=memfd",  // userfaultfd needs shared memory
+	               "BIGMAAC_MIN_FRY_SIZE=1024", NULL};
+	run_stage(self, "tier", NULL, env, 0);
+}
+
+// the parent changes and recycles its memory after the fork, the child has to see it as it was
+void test_fork(void) {
+	fprintf(stderr, "Fork\n");
+	char* big = malloc(BIG);
+	char* fry = malloc(FRY);
+	CHECK(big != NULL && fry != NULL);
+	fill(big, BIG, 1);
+	fill(fry, FRY, 2);
+	int go[2];
+	CHECK(pipe(go) == 0);
+	const pid_t pid = fork();
+	CHECK(pid >= 0);
+	if (pid == 0) {
+		char c;
+		close(go[1]);
+		const int ok = read(go[0], &c, 1) == 1 && filled(big, BIG, 1) && filled(fry, FRY, 2);
+		_exit(ok ? 0 : 1);
+	}
+	close(go[0]);
+	fill(fry, FRY, 3);
+	free(big);
+	char* again = malloc(BIG);
+	CHECK(again != NULL);
+	fill(again, BIG, 4);
+	CHECK(write(go[1], "x", 1) == 1);
+	close(go[1]);
+	int status;
+	CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	free(again);
+	free(fry);
+}
+
+void test_export(void) {
+	fprintf(stderr, "Export/import\n");
+	API(bigmaac_export);
+	API(bigmaac_import);
+	CHECK(api_bigmaac_export != NULL && api_bigmaac_import != NULL);
+	char* big = malloc(BIG);
+	CHECK(big != NULL);
+	fill(big, BIG, 5);
+	struct bigmaac_handle handle;
+	CHECK(api_bigmaac_export(big, &handle) == 0);
+	char* seen = api_bigmaac_import(&handle, BIGMAAC_IMPORT_READONLY);
+	char* copy = api_bigmaac_import(&handle, BIGMAAC_IMPORT_PRIVATE);
+	close(handle.fd);
+	CHECK(seen != NULL && copy != NULL && seen != big && filled(seen, BIG, 5) && filled(copy, BIG, 5));
+	fill(copy, BIG, 6);  // its own pages
+	CHECK(filled(big, BIG, 5));
+	fill(big, BIG, 7);  // the read only import follows, the private one keeps what it wrote
+	CHECK(filled(seen, BIG, 7) && filled(copy, BIG, 6));
+	char* shrunk = realloc(big, BIG / 2);  // the importers still see the tail
+	CHECK(shrunk == big && filled(seen, BIG, 7));
+	free(copy);
+	free(seen);
+	free(shrunk);
+}
+
+// run in a process of its own by test_persist, each read finds what the write before it left
+int persist_stage(const char* stage) {
+	API(bigmaac_set_root);
+	API(bigmaac_root);
+	API(bigmaac_checkpoint);
+	if (strcmp(stage, "write") == 0) {
+		char* big = malloc(BIG);
+		fill(big, BIG, 8);
+		api_bigmaac_set_root(big);
+		return 0;  // the journal is written at exit
+	}
+	if (strcmp(stage, "checkpoint") == 0) {  // a root pointing to two more, which are freed and moved after the checkpoint
+		char* big = malloc(BIG);
+		char** others = (char**)(big + sizeof(int));  // between the ints fill() writes
+		others[0] = malloc(BIG);
+		others[1] = malloc(BIG);
+		fill(big, BIG, 8);
+		fill(others[0], BIG, 12);
+		fill(others[1], BIG, 13);
+		api_bigmaac_set_root(big);
+		if (api_bigmaac_checkpoint() != 0) {
+			return 1;
+		}
+		free(others[0]);
+		char* moved = realloc(others[1], BIG / 2);
+		char* reused[2] = {malloc(BIG), malloc(BIG)};  // where the freed ones were without the journal
+		fill(reused[0], BIG, 14);
+		fill(reused[1], BIG, 15);
+		fill(moved, BIG / 2, 16);
+		_exit(0);  // a crash, no journal at exit
+	}
+	const char* big = api_bigmaac_root();
+	if (big == NULL || !filled(big, BIG, 8)) {
+		return 1;
+	}
+	char* const* others = (char* const*)(big + sizeof(int));
+	return strcmp(stage, "restart") != 0 || (filled(others[0], BIG, 12) && filled(others[1], BIG, 13)) ? 0 : 1;
+}
+
+void test_persist(const char* self) {
+	fprintf(stderr, "Persist\n");
+	char dir[] = "/tmp/bigmaac_test.XXXXXX";
+	CHECK(mkdtemp(dir) != NULL);
+	char persist[sizeof(dir) + sizeof("BIGMAAC_PERSIST=")];
+	snprintf(persist, sizeof(persist), "BIGMAAC_PERSIST=%s", dir);
+	char* env[] = {persist, NULL};
+	run_stage(self, "persist", "write", env, 1);  // the arena at the same address both times
+	run_stage(self, "persist", "read", env, 1);
+	run_stage(self, "persist", "checkpoint", env, 1);
+	run_stage(self, "persist", "restart", env, 1);
+	DIR* d = opendir(dir);
+	for (struct dirent* e = d == NULL ? NULL : readdir(d); e != NULL; e = readdir(d)) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		unlink(path);
+	}
+	if (d != NULL) {
+		closedir(d);
+	}
+	rmdir(dir);
+}
+
+int main(int argc, char** argv) {
+	if (argc == 3 && strcmp(argv[1], "persist") == 0) {
+		return persist_stage(argv[2]);
+	}
+	if (argc == 2 && strcmp(argv[1], "tier") == 0) {
+		return tier_stage();
+	}
+	if (argc == 2 && strcmp(argv[1], "tcache") == 0) {
+		return tcache_stage();
+	}
+	API(bigmaac_stats);
+	struct bigmaac_stats stats;
+	const int bigmaac = api_bigmaac_stats != NULL && api_bigmaac_stats(&stats) == 0;
+	test_realloc();
+	test_calloc();
+	test_aligned();
+	test_fork();
+	if (bigmaac) {
+		test_tier(argv[0]);
+		test_tcache(argv[0]);
+		test_export();
+		test_persist(argv[0]);
+	}
+
 	int* chunks[N];
 	int checksums[N];
 	int sizes[N];